@@ -0,0 +1,240 @@
+/*
+ * csim-3c.c - Classify misses as compulsory, capacity or conflict
+ *
+ * Alongside the real cache runs a fully associative LRU cache with the
+ * same number of lines. A miss on a block never touched before is
+ * compulsory; any other miss is a capacity miss if the shadow cache
+ * misses too, and a conflict miss if only the set mapping lost it.
+ *
+ * Every block ever touched gets a node in a pool whose index never
+ * changes, found through a block -> node hash table. Resident nodes are
+ * also on a doubly linked LRU list, so both the first-touch check and
+ * the shadow cache cost O(1) per access.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csim-3c.h"
+
+#define HEAT_COLUMNS 64
+
+typedef struct {
+    unsigned long long block;
+    int prev, next;             // LRU list links, -1 at the ends
+    int resident;               // in the shadow cache
+} node_t;
+
+struct classify {
+    int s, b;
+    long long capacity;         // lines in the cache, S * E
+
+    node_t *node;
+    int nnodes, room;
+    int *slot;                  // node index + 1 by hash, 0 = empty
+    size_t slots;
+
+    int mru, lru;
+    long long resident;
+
+    unsigned long long compulsory, capacity_misses, conflict;
+    unsigned long long *set_conflicts;
+};
+
+classify_t *classify_create(int s, int E, int b) {
+    classify_t *k = calloc(1, sizeof(classify_t));
+
+    if(k == NULL) {
+        return NULL;
+    }
+    k->s = s;
+    k->b = b;
+    k->capacity = (long long)E << s;
+    k->mru = k->lru = -1;
+    if((k->set_conflicts = calloc((size_t)1 << s, sizeof(unsigned long long))) == NULL) {
+        free(k);
+        return NULL;
+    }
+    return k;
+}
+
+void classify_free(classify_t *k) {
+    free(k->node);
+    free(k->slot);
+    free(k->set_conflicts);
+    free(k);
+}
+
+static inline size_t HashBlock(unsigned long long block, size_t slots) {
+    return (block * 0x9E3779B97F4A7C15ULL) >> 17 & (slots - 1);
+}
+
+static int Grow(classify_t *k) {
+    size_t slots = k->slots ? k->slots * 2 : 4096;
+    int *slot = calloc(slots, sizeof(int));
+
+    if(slot == NULL) {
+        return -1;
+    }
+    for(int i = 0; i < k->nnodes; i++) {
+        size_t j = HashBlock(k->node[i].block, slots);
+        while(slot[j] != 0) {
+            j = (j + 1) & (slots - 1);
+        }
+        slot[j] = i + 1;
+    }
+    free(k->slot);
+    k->slot = slot;
+    k->slots = slots;
+    return 0;
+}
+
+static void Unlink(classify_t *k, int i) {
+    node_t *n = &k->node[i];
+    if(n->prev >= 0) {
+        k->node[n->prev].next = n->next;
+    }
+    else {
+        k->mru = n->next;
+    }
+    if(n->next >= 0) {
+        k->node[n->next].prev = n->prev;
+    }
+    else {
+        k->lru = n->prev;
+    }
+}
+
+static void PushMru(classify_t *k, int i) {
+    node_t *n = &k->node[i];
+    n->prev = -1;
+    n->next = k->mru;
+    if(k->mru >= 0) {
+        k->node[k->mru].prev = i;
+    }
+    k->mru = i;
+    if(k->lru < 0) {
+        k->lru = i;
+    }
+}
+
+int classify_access(classify_t *k, unsigned long long address, int hit) {
+    unsigned long long block = address >> k->b;
+
+    if((size_t)(k->nnodes + 1) * 2 > k->slots && Grow(k) < 0) {
+        return -1;
+    }
+    size_t j = HashBlock(block, k->slots);
+    while(k->slot[j] != 0 && k->node[k->slot[j] - 1].block != block) {
+        j = (j + 1) & (k->slots - 1);
+    }
+
+    int i = k->slot[j] - 1;
+    int first_touch = i < 0;
+    int shadow_hit = !first_touch && k->node[i].resident;
+
+    if(first_touch) {
+        if(k->nnodes == k->room) {
+            int room = k->room ? k->room * 2 : 4096;
+            node_t *grown = realloc(k->node, room * sizeof(node_t));
+            if(grown == NULL) {
+                return -1;
+            }
+            k->node = grown;
+            k->room = room;
+        }
+        i = k->nnodes++;
+        k->node[i].block = block;
+        k->node[i].resident = 0;
+        k->slot[j] = i + 1;
+    }
+
+    if(shadow_hit) {
+        Unlink(k, i);
+    }
+    else {
+        k->node[i].resident = 1;
+        if(++k->resident > k->capacity) {
+            int victim = k->lru;
+            Unlink(k, victim);
+            k->node[victim].resident = 0;
+            k->resident--;
+        }
+    }
+    PushMru(k, i);
+
+    if(hit) {
+        return 0;
+    }
+    if(first_touch) {
+        k->compulsory++;
+    }
+    else if(!shadow_hit) {
+        k->capacity_misses++;
+    }
+    else {
+        k->conflict++;
+        k->set_conflicts[block & ((1ULL << k->s) - 1)]++;
+    }
+    return 0;
+}
+
+void classify_report(const classify_t *k, FILE *fp) {
+    static const char shades[] = " .:-=+*#%@";
+    unsigned long long misses = k->compulsory + k->capacity_misses + k->conflict;
+    unsigned long long sets = 1ULL << k->s;
+
+    fprintf(fp, "compulsory:%llu capacity:%llu conflict:%llu", k->compulsory,
+            k->capacity_misses, k->conflict);
+    if(misses) {
+        fprintf(fp, " (%.1f%% / %.1f%% / %.1f%%)", 100.0 * k->compulsory / misses,
+                100.0 * k->capacity_misses / misses, 100.0 * k->conflict / misses);
+    }
+    fputc('\n', fp);
+    if(k->conflict == 0) {
+        return;
+    }
+
+    // The hottest sets, by repeatedly taking the largest unprinted one
+    fprintf(fp, "conflict misses by set:");
+    unsigned long long printed_below = ~0ULL;
+    int shown = 0;
+    while(shown < 8) {
+        unsigned long long best = 0, best_set = 0;
+        for(unsigned long long i = 0; i < sets; i++) {
+            unsigned long long c = k->set_conflicts[i];
+            if(c > best && c < printed_below) {
+                best = c;
+                best_set = i;
+            }
+        }
+        if(best == 0) {
+            break;
+        }
+        for(unsigned long long i = best_set; i < sets && shown < 8; i++) {
+            if(k->set_conflicts[i] == best) {
+                fprintf(fp, " %llu:%llu", i, best);
+                shown++;
+            }
+        }
+        printed_below = best;
+    }
+    fputc('\n', fp);
+
+    // One column per group of sets, darker for more conflict misses
+    int columns = sets < HEAT_COLUMNS ? (int)sets : HEAT_COLUMNS;
+    unsigned long long per = sets / columns;
+    unsigned long long heat[HEAT_COLUMNS] = { 0 }, hottest = 0;
+    for(unsigned long long i = 0; i < sets; i++) {
+        heat[i / per] += k->set_conflicts[i];
+    }
+    for(int c = 0; c < columns; c++) {
+        if(heat[c] > hottest) {
+            hottest = heat[c];
+        }
+    }
+    fprintf(fp, "heatmap, %llu set%s per column: |", per, per == 1 ? "" : "s");
+    for(int c = 0; c < columns; c++) {
+        int shade = heat[c] == 0 ? 0 : 1 + (int)((heat[c] * (sizeof(shades) - 3)) / hottest);
+        fputc(shades[shade], fp);
+    }
+    fprintf(fp, "|\n");
+}
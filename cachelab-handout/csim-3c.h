@@ -0,0 +1,24 @@
+/*
+ * csim-3c.h - Classify misses as compulsory, capacity or conflict
+ */
+
+#ifndef CSIM_3C_H
+#define CSIM_3C_H
+
+#include <stdio.h>
+
+typedef struct classify classify_t;
+
+// classify_create - Classifier for a 2^s x E cache of 2^b byte blocks
+classify_t *classify_create(int s, int E, int b);
+
+// classify_access - Feed every demand access with whether the real cache
+// hit. Returns -1 if out of memory.
+int classify_access(classify_t *k, unsigned long long address, int hit);
+
+// classify_report - The three counts and a per-set conflict heatmap
+void classify_report(const classify_t *k, FILE *fp);
+
+void classify_free(classify_t *k);
+
+#endif /* CSIM_3C_H */
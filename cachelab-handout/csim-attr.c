@@ -0,0 +1,191 @@
+/*
+ * csim-attr.c - Attribute hits and misses to instructions and address ranges
+ *
+ * Lackey writes each instruction's I record before the data accesses
+ * it makes, so the last I address seen is the PC of every L/S/M after
+ * it. Per-PC counts live in an open-addressing table; regions are few
+ * and checked in order, the first match winning.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csim-attr.h"
+
+#define ATTR_MAX_REGIONS 32
+
+typedef struct {
+    unsigned long long accesses;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} counts_t;
+
+typedef struct {
+    unsigned long long pc;
+    int used;
+    counts_t n;
+} pc_entry_t;
+
+typedef struct {
+    char name[32];
+    unsigned long long start, end;
+    counts_t n;
+} region_t;
+
+struct attr {
+    pc_entry_t *pcs;
+    size_t slots, npcs;
+    region_t region[ATTR_MAX_REGIONS];
+    int nregions;
+    counts_t other;             // accesses outside every region
+};
+
+attr_t *attr_create(void) {
+    return calloc(1, sizeof(attr_t));
+}
+
+void attr_free(attr_t *a) {
+    free(a->pcs);
+    free(a);
+}
+
+int attr_add_region(attr_t *a, const char *spec, char *err, size_t err_len) {
+    region_t *r = &a->region[a->nregions];
+    int len;
+
+    if(a->nregions == ATTR_MAX_REGIONS) {
+        snprintf(err, err_len, "at most %d regions", ATTR_MAX_REGIONS);
+        return -1;
+    }
+    memset(r, 0, sizeof(region_t));
+    if(sscanf(spec, "%31[^:]:%llx:%llx%n", r->name, &r->start, &r->end, &len) != 3 ||
+       spec[len] != '\0' || r->end <= r->start) {
+        snprintf(err, err_len, "%s: expected name:start:end in hex, start < end", spec);
+        return -1;
+    }
+    a->nregions++;
+    return 0;
+}
+
+static inline size_t HashPc(unsigned long long pc, size_t slots) {
+    return (pc * 0x9E3779B97F4A7C15ULL) >> 20 & (slots - 1);
+}
+
+static int Grow(attr_t *a) {
+    size_t slots = a->slots ? a->slots * 2 : 1024;
+    pc_entry_t *pcs = calloc(slots, sizeof(pc_entry_t));
+
+    if(pcs == NULL) {
+        return -1;
+    }
+    for(size_t i = 0; i < a->slots; i++) {
+        if(a->pcs[i].used) {
+            size_t j = HashPc(a->pcs[i].pc, slots);
+            while(pcs[j].used) {
+                j = (j + 1) & (slots - 1);
+            }
+            pcs[j] = a->pcs[i];
+        }
+    }
+    free(a->pcs);
+    a->pcs = pcs;
+    a->slots = slots;
+    return 0;
+}
+
+static inline void Count(counts_t *n, int hit, int evicted) {
+    n->accesses++;
+    n->hits += hit;
+    n->misses += !hit;
+    n->evictions += evicted;
+}
+
+int attr_record(attr_t *a, unsigned long long pc, unsigned long long addr, int hit, int evicted) {
+    if((a->npcs + 1) * 2 > a->slots && Grow(a) < 0) {
+        return -1;
+    }
+    size_t i = HashPc(pc, a->slots);
+    while(a->pcs[i].used && a->pcs[i].pc != pc) {
+        i = (i + 1) & (a->slots - 1);
+    }
+    if(!a->pcs[i].used) {
+        a->pcs[i].used = 1;
+        a->pcs[i].pc = pc;
+        a->npcs++;
+    }
+    Count(&a->pcs[i].n, hit, evicted);
+
+    for(int r = 0; r < a->nregions; r++) {
+        if(addr >= a->region[r].start && addr < a->region[r].end) {
+            Count(&a->region[r].n, hit, evicted);
+            return 0;
+        }
+    }
+    Count(&a->other, hit, evicted);
+    return 0;
+}
+
+// Most misses first, then most accesses, then lowest PC
+static int ByMisses(const void *x, const void *y) {
+    const pc_entry_t *p = x, *q = y;
+    if(p->n.misses != q->n.misses) {
+        return p->n.misses < q->n.misses ? 1 : -1;
+    }
+    if(p->n.accesses != q->n.accesses) {
+        return p->n.accesses < q->n.accesses ? 1 : -1;
+    }
+    return p->pc < q->pc ? -1 : p->pc > q->pc;
+}
+
+static void PrintCounts(FILE *fp, const char *label, const counts_t *n, unsigned long long total_misses) {
+    fprintf(fp, "%-18s %12llu %12llu %12llu %12llu %7.2f%% %7.2f%%\n", label,
+            n->accesses, n->hits, n->misses, n->evictions,
+            n->accesses ? 100.0 * n->misses / n->accesses : 0.0,
+            total_misses ? 100.0 * n->misses / total_misses : 0.0);
+}
+
+void attr_report(const attr_t *a, int top, FILE *fp) {
+    pc_entry_t *sorted = malloc((a->npcs + 1) * sizeof(pc_entry_t));
+    unsigned long long total_misses = a->other.misses;
+    size_t n = 0;
+    char label[32];
+
+    for(int r = 0; r < a->nregions; r++) {
+        total_misses += a->region[r].n.misses;
+    }
+    if(sorted == NULL) {
+        fprintf(fp, "attribution: out of memory for the report\n");
+        return;
+    }
+    for(size_t i = 0; i < a->slots; i++) {
+        if(a->pcs[i].used) {
+            sorted[n++] = a->pcs[i];
+        }
+    }
+    qsort(sorted, n, sizeof(pc_entry_t), ByMisses);
+
+    fprintf(fp, "%-18s %12s %12s %12s %12s %8s %8s\n", "pc", "accesses", "hits", "misses",
+            "evictions", "miss%", "of all");
+    for(size_t i = 0; i < n && (int)i < top; i++) {
+        if(sorted[i].pc == 0) {
+            snprintf(label, sizeof(label), "(no I record)");
+        }
+        else {
+            snprintf(label, sizeof(label), "%llx", sorted[i].pc);
+        }
+        PrintCounts(fp, label, &sorted[i].n, total_misses);
+    }
+    if(n > (size_t)top) {
+        fprintf(fp, "... %zu more instructions\n", n - top);
+    }
+    free(sorted);
+
+    if(a->nregions == 0) {
+        return;
+    }
+    fprintf(fp, "\n%-18s %12s %12s %12s %12s %8s %8s\n", "region", "accesses", "hits", "misses",
+            "evictions", "miss%", "of all");
+    for(int r = 0; r < a->nregions; r++) {
+        PrintCounts(fp, a->region[r].name, &a->region[r].n, total_misses);
+    }
+    PrintCounts(fp, "(other)", &a->other, total_misses);
+}
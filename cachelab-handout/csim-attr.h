@@ -0,0 +1,27 @@
+/*
+ * csim-attr.h - Attribute hits and misses to instructions and address ranges
+ */
+
+#ifndef CSIM_ATTR_H
+#define CSIM_ATTR_H
+
+#include <stdio.h>
+
+typedef struct attr attr_t;
+
+attr_t *attr_create(void);
+
+// attr_add_region - Track the range given as name:start:end (hex, end
+// exclusive). Returns -1 with a message in err on a bad spec.
+int attr_add_region(attr_t *a, const char *spec, char *err, size_t err_len);
+
+// attr_record - One data access at addr by the instruction at pc (0 if
+// the trace has no I records). Returns -1 if out of memory.
+int attr_record(attr_t *a, unsigned long long pc, unsigned long long addr, int hit, int evicted);
+
+// attr_report - The top instructions by misses, then every region
+void attr_report(const attr_t *a, int top, FILE *fp);
+
+void attr_free(attr_t *a);
+
+#endif /* CSIM_ATTR_H */
@@ -0,0 +1,443 @@
+/*
+ * csim-cache.c - One set-associative cache level
+ *
+ * Each line has one 64-bit word of replacement state in c->stamp, read
+ * according to the policy:
+ *
+ *   LRU, FIFO   clock at last use / at fill, the victim is the smallest
+ *   RANDOM      unused
+ *   PLRU_TREE   words 0..E-2 of the set are the tree's direction bits
+ *               (node k's children are 2k and 2k+1, root 1, leaves E..2E-1)
+ *   PLRU_BIT    MRU bit; once every bit is set, all but the newest clear
+ *   SRRIP/BRRIP re-reference prediction value 0..RRIP_MAX, a hit resets it
+ *               to 0 and the victim is the first line at RRIP_MAX
+ *   OPT         next_use of the last access, the victim is the largest
+ */
+#define _POSIX_C_SOURCE 200112L // posix_memalign
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "csim-cache.h"
+
+// Never produced by address >> (s + b) since s + b > 0
+#define INVALID_TAG (~0ULL)
+
+#define CACHE_BATCH 256         // accesses decoded at a time by cache_access_batch()
+#define CACHE_LOOKAHEAD 8       // how many accesses ahead its sets are fetched
+
+#define RRIP_MAX 3
+#define BRRIP_LONG_ODDS 32      // BRRIP inserts at RRIP_MAX - 1 once in this many fills
+
+static const char *policy_names[CACHE_NPOLICIES] = {
+    "lru", "fifo", "random", "plru", "bitplru", "srrip", "brrip", "opt"
+};
+
+int cache_init(cache_t *c, int s, int E, int b) {
+    memset(c, 0, sizeof(cache_t));
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->stride = E == 1 ? 1 : (E + 1) & ~1;
+    c->valid_words = (E + 63) / 64;
+    c->policy = CACHE_LRU;
+    c->rng = 0x2545F4914F6CDD1DULL;
+
+    size_t S = (size_t)1 << s;
+    size_t ntags = S * c->stride;
+    size_t nstamps = S * E;
+    size_t nbits = S * c->valid_words;
+    void *mem;
+    if(posix_memalign(&mem, 64, (ntags + nstamps + 3 * nbits) * sizeof(unsigned long long)) != 0) {
+        return -1;
+    }
+
+    c->tag = mem;
+    c->stamp = c->tag + ntags;
+    c->valid = c->stamp + nstamps;
+    c->dirty = c->valid + nbits;
+    c->prefetched = c->dirty + nbits;
+    for(size_t i = 0; i < ntags; i++) {
+        c->tag[i] = INVALID_TAG;
+    }
+    memset(c->stamp, 0, (nstamps + 3 * nbits) * sizeof(unsigned long long));
+    return 0;
+}
+
+void cache_free(cache_t *c) {
+    free(c->tag);
+    c->tag = NULL;
+}
+
+int cache_parse_policy(const char *name) {
+    for(int i = 0; i < CACHE_NPOLICIES; i++) {
+        if(strcmp(name, policy_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *cache_policy_name(int policy) {
+    return policy_names[policy];
+}
+
+int cache_set_policy(cache_t *c, int policy) {
+    if(policy == CACHE_PLRU_TREE && (c->E & (c->E - 1)) != 0) {
+        return -1;
+    }
+    c->policy = policy;
+    return 0;
+}
+
+static inline unsigned long long NextRandom(cache_t *c) {
+    c->rng ^= c->rng << 13;
+    c->rng ^= c->rng >> 7;
+    c->rng ^= c->rng << 17;
+    return c->rng;
+}
+
+// Point every tree node on way's path away from it
+static inline void TreeTouch(unsigned long long *bits, int E, int way) {
+    int node = way + E;
+    while(node > 1) {
+        bits[node / 2 - 1] = !(node & 1);
+        node /= 2;
+    }
+}
+
+static inline void BitTouch(unsigned long long *bits, int E, int way) {
+    bits[way] = 1;
+    for(int i = 0; i < E; i++) {
+        if(!bits[i]) {
+            return;
+        }
+    }
+    for(int i = 0; i < E; i++) {
+        bits[i] = i == way;
+    }
+}
+
+// Policy state update on a hit
+static inline void OnHit(cache_t *c, unsigned long long *state, int way) {
+    switch (c->policy) {
+        case CACHE_LRU:
+            state[way] = c->clock;
+            break;
+        case CACHE_PLRU_TREE:
+            TreeTouch(state, c->E, way);
+            break;
+        case CACHE_PLRU_BIT:
+            BitTouch(state, c->E, way);
+            break;
+        case CACHE_SRRIP:
+        case CACHE_BRRIP:
+            state[way] = 0;
+            break;
+        case CACHE_OPT:
+            state[way] = c->next_use;
+            break;
+        default:                // FIFO and RANDOM ignore hits
+            break;
+    }
+}
+
+// Policy state update for a newly filled line
+static inline void OnFill(cache_t *c, unsigned long long *state, int way) {
+    switch (c->policy) {
+        case CACHE_LRU:
+        case CACHE_FIFO:
+            state[way] = c->clock;
+            break;
+        case CACHE_SRRIP:
+            state[way] = RRIP_MAX - 1;
+            break;
+        case CACHE_BRRIP:
+            state[way] = NextRandom(c) % BRRIP_LONG_ODDS ? RRIP_MAX : RRIP_MAX - 1;
+            break;
+        default:
+            OnHit(c, state, way);
+            break;
+    }
+}
+
+// Way to replace in a full set
+static inline int PickVictim(cache_t *c, unsigned long long *state) {
+    int E = c->E;
+    int way = 0;
+
+    switch (c->policy) {
+        case CACHE_RANDOM:
+            return NextRandom(c) % E;
+        case CACHE_PLRU_TREE: {
+            int node = 1;
+            while(node < E) {
+                node = 2 * node + (int)state[node - 1];
+            }
+            return node - E;
+        }
+        case CACHE_PLRU_BIT:
+            while(way < E - 1 && state[way]) {
+                way++;
+            }
+            return way;
+        case CACHE_SRRIP:
+        case CACHE_BRRIP:
+            for(;;) {
+                for(int i = 0; i < E; i++) {
+                    if(state[i] >= RRIP_MAX) {
+                        return i;
+                    }
+                }
+                for(int i = 0; i < E; i++) {
+                    state[i]++;
+                }
+            }
+        case CACHE_OPT:
+            for(int i = 1; i < E; i++) {
+                if(state[i] > state[way]) {
+                    way = i;
+                }
+            }
+            return way;
+        default:
+            // LRU/FIFO: the line with the oldest stamp
+            for(int i = 1; i < E; i++) {
+                if(state[i] < state[way]) {
+                    way = i;
+                }
+            }
+            return way;
+    }
+}
+
+// Way holding tag in a set's tag row, or -1. Invalid and padding ways
+// hold INVALID_TAG, so no valid-bit test is needed.
+static inline int FindWay(const unsigned long long *tags, int stride, unsigned long long tag) {
+#ifdef __SSE2__
+    if(stride > 1) {
+        // SSE2 has no 64-bit compare: compare 32-bit halves and AND
+        // each half with its swapped neighbour
+        __m128i key = _mm_set1_epi64x(tag);
+        for(int i = 0; i < stride; i += 64) {
+            unsigned long long hits = 0;
+            int n = stride - i < 64 ? stride - i : 64;
+            for(int j = 0; j < n; j += 2) {
+                __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(tags + i + j)), key);
+                eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+                hits |= (unsigned long long)_mm_movemask_pd(_mm_castsi128_pd(eq)) << j;
+            }
+            if(hits) {
+                return i + __builtin_ctzll(hits);
+            }
+        }
+        return -1;
+    }
+#endif
+    for(int i = 0; i < stride; i++) {
+        if(tags[i] == tag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// First invalid way of a set, or -1 if the set is full
+static inline int FindFree(const unsigned long long *valid, int valid_words, int E) {
+    for(int w = 0; w < valid_words; w++) {
+        unsigned long long free_ways = ~valid[w];
+        if(w == valid_words - 1 && E % 64) {
+            free_ways &= (1ULL << (E % 64)) - 1;
+        }
+        if(free_ways) {
+            return w * 64 + __builtin_ctzll(free_ways);
+        }
+    }
+    return -1;
+}
+
+static inline void SetBit(unsigned long long *words, int way, int on) {
+    if(on) {
+        words[way / 64] |= 1ULL << (way % 64);
+    }
+    else {
+        words[way / 64] &= ~(1ULL << (way % 64));
+    }
+}
+
+static inline int GetBit(const unsigned long long *words, int way) {
+    return words[way / 64] >> (way % 64) & 1;
+}
+
+// Count a demand hit on way and update its state
+static inline int DemandHit(cache_t *c, unsigned long long set_index, int way, int write) {
+    unsigned long long *prefetched = c->prefetched + set_index * c->valid_words;
+
+    c->hits++;
+    OnHit(c, c->stamp + set_index * c->E, way);
+    if(write) {
+        SetBit(c->dirty + set_index * c->valid_words, way, 1);
+    }
+    if(GetBit(prefetched, way)) {
+        SetBit(prefetched, way, 0);
+        return CACHE_HIT_PREFETCHED;
+    }
+    return CACHE_HIT;
+}
+
+int cache_lookup(cache_t *c, unsigned long long address, int write) {
+    // Address: t bits | s bits | b bits
+    //          Tag      SetIndex BlockOffset
+    unsigned long long tag_offset = address >> (c->s + c->b);
+    unsigned long long set_index = (address >> c->b) & ((1ULL << c->s) - 1);
+
+    c->clock++;
+    int way = FindWay(c->tag + set_index * c->stride, c->stride, tag_offset);
+    if(way < 0) {
+        c->misses++;
+        return 0;
+    }
+
+    return DemandHit(c, set_index, way, write);
+}
+
+// Place a block known not to be in its set
+static inline void FillMissing(cache_t *c, unsigned long long set_index, unsigned long long tag_offset,
+                               int dirty, int prefetch, cache_victim_t *victim) {
+    unsigned long long *tags = c->tag + set_index * c->stride;
+    unsigned long long *stamps = c->stamp + set_index * c->E;
+    unsigned long long *valid = c->valid + set_index * c->valid_words;
+    unsigned long long *dirties = c->dirty + set_index * c->valid_words;
+    unsigned long long *prefetched = c->prefetched + set_index * c->valid_words;
+
+    victim->valid = 0;
+    int way = FindFree(valid, c->valid_words, c->E);
+    if(way >= 0) {
+        SetBit(valid, way, 1);
+    }
+    else {
+        way = PickVictim(c, stamps);
+        victim->valid = 1;
+        victim->dirty = GetBit(dirties, way);
+        victim->prefetched = GetBit(prefetched, way);
+        victim->addr = (tags[way] << (c->s + c->b)) | (set_index << c->b);
+    }
+
+    tags[way] = tag_offset;
+    OnFill(c, stamps, way);
+    SetBit(dirties, way, dirty);
+    SetBit(prefetched, way, prefetch);
+}
+
+void cache_fill(cache_t *c, unsigned long long address, int dirty, cache_victim_t *victim) {
+    unsigned long long tag_offset = address >> (c->s + c->b);
+    unsigned long long set_index = (address >> c->b) & ((1ULL << c->s) - 1);
+
+    c->clock++;
+    int way = FindWay(c->tag + set_index * c->stride, c->stride, tag_offset);
+    if(way >= 0) {
+        // Already there (a write-back into a level that kept a copy)
+        victim->valid = 0;
+        OnHit(c, c->stamp + set_index * c->E, way);
+        if(dirty) {
+            SetBit(c->dirty + set_index * c->valid_words, way, 1);
+        }
+        return;
+    }
+    FillMissing(c, set_index, tag_offset, dirty, 0, victim);
+    c->evictions += victim->valid;
+}
+
+int cache_access(cache_t *c, unsigned long long address, int write, cache_victim_t *victim) {
+    unsigned long long tag_offset = address >> (c->s + c->b);
+    unsigned long long set_index = (address >> c->b) & ((1ULL << c->s) - 1);
+
+    // Same as cache_lookup() then cache_fill(), with one tag search
+    c->clock++;
+    int way = FindWay(c->tag + set_index * c->stride, c->stride, tag_offset);
+    if(way >= 0) {
+        victim->valid = 0;
+        return DemandHit(c, set_index, way, write);
+    }
+    c->misses++;
+    FillMissing(c, set_index, tag_offset, write, 0, victim);
+    c->evictions += victim->valid;
+    return CACHE_MISS;
+}
+
+// Start pulling a set's tags, state and valid bits into the host cache
+static inline void TouchSet(const cache_t *c, unsigned long long set_index) {
+    __builtin_prefetch(c->tag + set_index * c->stride);
+    __builtin_prefetch(c->stamp + set_index * c->E);
+    __builtin_prefetch(c->valid + set_index * c->valid_words);
+}
+
+void cache_access_batch(cache_t *c, const unsigned long long *addrs, size_t n) {
+    unsigned long long tags[CACHE_BATCH], sets[CACHE_BATCH];
+    unsigned long long set_mask = (1ULL << c->s) - 1;
+    int tag_shift = c->s + c->b;
+    cache_victim_t victim;
+
+    for(size_t base = 0; base < n; base += CACHE_BATCH) {
+        const unsigned long long *a = addrs + base;
+        size_t m = n - base < CACHE_BATCH ? n - base : CACHE_BATCH;
+
+        // Straight-line pass the compiler can vectorize
+        for(size_t i = 0; i < m; i++) {
+            tags[i] = a[i] >> tag_shift;
+            sets[i] = (a[i] >> c->b) & set_mask;
+        }
+        for(size_t i = 0; i < m && i < CACHE_LOOKAHEAD; i++) {
+            TouchSet(c, sets[i]);
+        }
+
+        for(size_t i = 0; i < m; i++) {
+            if(i + CACHE_LOOKAHEAD < m) {
+                TouchSet(c, sets[i + CACHE_LOOKAHEAD]);
+            }
+            c->clock++;
+            int way = FindWay(c->tag + sets[i] * c->stride, c->stride, tags[i]);
+            if(way >= 0) {
+                DemandHit(c, sets[i], way, 0);
+                continue;
+            }
+            c->misses++;
+            FillMissing(c, sets[i], tags[i], 0, 0, &victim);
+            c->evictions += victim.valid;
+        }
+    }
+}
+
+int cache_prefetch(cache_t *c, unsigned long long address, cache_victim_t *victim) {
+    unsigned long long tag_offset = address >> (c->s + c->b);
+    unsigned long long set_index = (address >> c->b) & ((1ULL << c->s) - 1);
+
+    victim->valid = 0;
+    if(tag_offset == INVALID_TAG) {
+        return 0;               // the very top block, not representable
+    }
+    c->clock++;
+    if(FindWay(c->tag + set_index * c->stride, c->stride, tag_offset) >= 0) {
+        return 0;
+    }
+    FillMissing(c, set_index, tag_offset, 0, 1, victim);
+    return 1;
+}
+
+int cache_remove(cache_t *c, unsigned long long address, int *dirty) {
+    unsigned long long tag_offset = address >> (c->s + c->b);
+    unsigned long long set_index = (address >> c->b) & ((1ULL << c->s) - 1);
+    unsigned long long *tags = c->tag + set_index * c->stride;
+
+    int way = FindWay(tags, c->stride, tag_offset);
+    if(way < 0) {
+        return 0;
+    }
+    *dirty = GetBit(c->dirty + set_index * c->valid_words, way);
+    tags[way] = INVALID_TAG;
+    SetBit(c->valid + set_index * c->valid_words, way, 0);
+    SetBit(c->dirty + set_index * c->valid_words, way, 0);
+    SetBit(c->prefetched + set_index * c->valid_words, way, 0);
+    return 1;
+}
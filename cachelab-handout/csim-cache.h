@@ -0,0 +1,106 @@
+/*
+ * csim-cache.h - One set-associative cache level
+ *
+ * The lookup/fill split lets callers build hierarchies on top: csim's
+ * Update() is cache_access(), which is a cache_lookup() followed by a
+ * cache_fill() on a miss. Replacement is LRU unless cache_set_policy()
+ * picks another policy.
+ */
+
+#ifndef CSIM_CACHE_H
+#define CSIM_CACHE_H
+
+// Replacement policies
+typedef enum {
+    CACHE_LRU,
+    CACHE_FIFO,
+    CACHE_RANDOM,
+    CACHE_PLRU_TREE,            // binary tree of E - 1 direction bits, E a power of two
+    CACHE_PLRU_BIT,             // one MRU bit per line
+    CACHE_SRRIP,                // 2-bit re-reference prediction, insert at "long"
+    CACHE_BRRIP,                // as SRRIP, but mostly insert at "distant"
+    CACHE_OPT,                  // Belady: evict the line used furthest in the future
+    CACHE_NPOLICIES
+} cache_policy_t;
+
+// One contiguous block holds the whole cache as a structure of arrays:
+// a set's tags sit next to each other (padded to an even count so they
+// can be compared two at a time), its LRU stamps likewise, and its
+// valid and dirty bits are packed into 64-bit words.
+typedef struct {
+    int s, E, b;
+    int stride;                 // tags per set, E rounded up to even
+    int valid_words;            // 64-bit valid/dirty words per set
+    unsigned long long *tag;    // S * stride, padding holds INVALID_TAG
+    unsigned long long *stamp;  // S * E, per-line policy state (see csim-cache.c)
+    unsigned long long *valid;  // S * valid_words
+    unsigned long long *dirty;  // S * valid_words
+    unsigned long long *prefetched; // S * valid_words, filled by cache_prefetch() and not used yet
+    unsigned long long clock;   // bumped once per lookup or fill
+    int policy;
+    unsigned long long rng;     // CACHE_RANDOM and CACHE_BRRIP
+    unsigned long long next_use;// CACHE_OPT: set by the caller before each
+                                // lookup/fill to when this block is next used
+
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;   // by demand fills only
+} cache_t;
+
+// cache_lookup()/cache_access() results; both hits are true
+#define CACHE_MISS 0
+#define CACHE_HIT 1
+#define CACHE_HIT_PREFETCHED 2  // first demand use of a prefetched line
+
+// A line pushed out by cache_fill()
+typedef struct {
+    int valid;                  // 0 if the fill took a free way
+    int dirty;
+    int prefetched;             // a prefetched line that was never used
+    unsigned long long addr;    // first byte of the evicted block
+} cache_victim_t;
+
+// cache_init - Allocate an empty 2^s x E cache of 2^b byte blocks.
+// Returns -1 if out of memory.
+int cache_init(cache_t *c, int s, int E, int b);
+
+void cache_free(cache_t *c);
+
+// cache_parse_policy - Policy from its name (lru, fifo, random, plru,
+// bitplru, srrip, brrip, opt), or -1
+int cache_parse_policy(const char *name);
+
+const char *cache_policy_name(int policy);
+
+// cache_set_policy - Switch an empty cache to another policy. Returns -1
+// if the geometry does not suit it (tree PLRU needs a power-of-two E).
+int cache_set_policy(cache_t *c, int policy);
+
+// cache_lookup - Count a hit or a miss for address. A hit becomes the
+// most recently used line of its set and turns dirty if write is set.
+// Returns one of the CACHE_ results.
+int cache_lookup(cache_t *c, unsigned long long address, int write);
+
+// cache_fill - Make address's block the most recently used line of its
+// set, merging dirty into it. The line it replaces, if any, is counted
+// as an eviction and described in *victim.
+void cache_fill(cache_t *c, unsigned long long address, int dirty, cache_victim_t *victim);
+
+// cache_access - Lookup and, on a miss, fill (write-allocate). Returns
+// one of the CACHE_ results.
+int cache_access(cache_t *c, unsigned long long address, int write, cache_victim_t *victim);
+
+// cache_access_batch - cache_access() for n reads in order, keeping
+// only the counts. Looks ahead in the batch to fetch the sets it needs.
+void cache_access_batch(cache_t *c, const unsigned long long *addrs, size_t n);
+
+// cache_prefetch - Fill address's block unless it is already there,
+// marked as prefetched and without touching the demand counters.
+// Returns 1 if it was filled.
+int cache_prefetch(cache_t *c, unsigned long long address, cache_victim_t *victim);
+
+// cache_remove - Drop address's block without counting anything.
+// Returns 1 if it was there, with its dirty bit in *dirty.
+int cache_remove(cache_t *c, unsigned long long address, int *dirty);
+
+#endif /* CSIM_CACHE_H */
@@ -0,0 +1,281 @@
+/*
+ * csim-hier.c - Multi-level cache hierarchy built from csim-cache levels
+ *
+ * Every level is write-back and write-allocate. A demand access walks
+ * down its path (L1I or L1D, then the shared levels) until some level
+ * hits, paying each level's latency on the way; a miss everywhere pays
+ * the memory latency too. How fills and victims move between levels is
+ * up to the policy:
+ *
+ *   NINE       each level that missed is filled on the way back up;
+ *              dirty victims are written into the level below
+ *   inclusive  as NINE, and a block evicted from a lower level is also
+ *              invalidated in every level above it
+ *   exclusive  only the top level is filled; a lower level hit moves
+ *              the block up, and every top level victim, clean or
+ *              dirty, moves down one level; all levels share one
+ *              block size
+ *
+ * Write-backs are not demand accesses, so they do not count as hits or
+ * misses, but they can cause evictions further down.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csim-cache.h"
+#include "csim-hier.h"
+
+typedef struct {
+    char name[16];
+    int latency;
+    cache_t cache;
+    unsigned long long writebacks;      // dirty victims sent down (or to memory)
+    unsigned long long invalidations;   // copies dropped for inclusion
+} level_t;
+
+struct hier {
+    hier_policy_t policy;
+    int mem_latency;
+    int replacement;
+    level_t level[HIER_MAX_LEVELS];
+    int nlevels;
+
+    // Level indices from the top; the two paths share all but the first
+    int ipath[HIER_MAX_LEVELS], ilen;
+    int dpath[HIER_MAX_LEVELS], dlen;
+
+    unsigned long long accesses;        // demand accesses at the top
+    unsigned long long cycles;
+    unsigned long long mem_reads;
+    unsigned long long mem_writes;
+};
+
+static void fill(hier_t *h, const int *path, int n, int i, unsigned long long address, int dirty);
+
+hier_t *hier_create(hier_policy_t policy, int mem_latency, int replacement) {
+    hier_t *h = calloc(1, sizeof(hier_t));
+
+    if(h != NULL) {
+        h->policy = policy;
+        h->mem_latency = mem_latency;
+        h->replacement = replacement;
+    }
+    return h;
+}
+
+int hier_parse_policy(const char *name) {
+    if(strcmp(name, "nine") == 0) {
+        return HIER_NINE;
+    }
+    if(strcmp(name, "inclusive") == 0) {
+        return HIER_INCLUSIVE;
+    }
+    if(strcmp(name, "exclusive") == 0) {
+        return HIER_EXCLUSIVE;
+    }
+    return -1;
+}
+
+// build_paths - Work out both access paths from the level order
+static void build_paths(hier_t *h) {
+    h->ilen = h->dlen = 0;
+    for(int i = 0; i < h->nlevels; i++) {
+        if(strcmp(h->level[i].name, "L1I") == 0) {
+            h->ipath[h->ilen++] = i;
+            continue;
+        }
+        h->dpath[h->dlen++] = i;
+        if(h->dlen > 1 && h->ilen > 0) {
+            h->ipath[h->ilen++] = i;
+        }
+    }
+}
+
+int hier_add_level(hier_t *h, const char *spec, char *err, size_t err_len) {
+    level_t *l = &h->level[h->nlevels];
+    int s, E, b, latency;
+    int len;
+
+    if(h->nlevels == HIER_MAX_LEVELS) {
+        snprintf(err, err_len, "at most %d levels", HIER_MAX_LEVELS);
+        return -1;
+    }
+    if(sscanf(spec, "%15[^:]:%d:%d:%d:%d%n", l->name, &s, &E, &b, &latency, &len) != 5 ||
+       spec[len] != '\0') {
+        snprintf(err, err_len, "%s: expected name:s:E:b:latency", spec);
+        return -1;
+    }
+    if(s < 0 || E <= 0 || b < 0 || s + b <= 0 || s + b >= 64 || latency < 0) {
+        snprintf(err, err_len, "%s: bad geometry", spec);
+        return -1;
+    }
+    for(int i = 0; i < h->nlevels; i++) {
+        if(strcmp(h->level[i].name, l->name) == 0) {
+            snprintf(err, err_len, "%s: duplicate level name", spec);
+            return -1;
+        }
+    }
+    // Blocks move between levels whole, so they must be the same size
+    if(h->policy == HIER_EXCLUSIVE && h->nlevels > 0 && b != h->level[0].cache.b) {
+        snprintf(err, err_len, "%s: exclusive levels need the same b as %s", spec, h->level[0].name);
+        return -1;
+    }
+    if(cache_init(&l->cache, s, E, b) < 0) {
+        snprintf(err, err_len, "%s: out of memory", spec);
+        return -1;
+    }
+    if(cache_set_policy(&l->cache, h->replacement) < 0) {
+        cache_free(&l->cache);
+        snprintf(err, err_len, "%s: %s replacement needs a power-of-two E", spec,
+                 cache_policy_name(h->replacement));
+        return -1;
+    }
+    l->latency = latency;
+    h->nlevels++;
+    build_paths(h);
+    return 0;
+}
+
+int hier_has_icache(const hier_t *h) {
+    return h->ilen > 0;
+}
+
+// back_invalidate - Inclusion: drop every copy of a block evicted from
+// level li in the levels above it. Returns 1 if one of them was dirty.
+static int back_invalidate(hier_t *h, int li, unsigned long long address) {
+    const int *paths[2] = { h->dpath, h->ipath };
+    const int lens[2] = { h->dlen, h->ilen };
+    int block = 1 << h->level[li].cache.b;
+    int dirty = 0;
+
+    for(int p = 0; p < 2; p++) {
+        for(int k = 0; k < lens[p] && paths[p][k] != li; k++) {
+            level_t *up = &h->level[paths[p][k]];
+            if(p == 1 && k > 0) {
+                break;          // shared with the data path, already done
+            }
+            // A big lower block can cover several upper blocks
+            int step = 1 << up->cache.b;
+            for(int off = 0; off < block; off += step) {
+                int d;
+                if(cache_remove(&up->cache, address + off, &d)) {
+                    up->invalidations++;
+                    dirty |= d;
+                }
+            }
+        }
+    }
+    return dirty;
+}
+
+// evicted - Deal with the victim of a fill into path[i]
+static void evicted(hier_t *h, const int *path, int n, int i, cache_victim_t *victim) {
+    level_t *l = &h->level[path[i]];
+    int dirty = victim->dirty;
+
+    if(h->policy == HIER_INCLUSIVE && i > 0) {
+        dirty |= back_invalidate(h, path[i], victim->addr);
+    }
+    if(h->policy == HIER_EXCLUSIVE && i + 1 < n) {
+        l->writebacks += dirty;
+        fill(h, path, n, i + 1, victim->addr, dirty);
+        return;
+    }
+    if(!dirty) {
+        return;
+    }
+    l->writebacks++;
+    if(i + 1 < n) {
+        fill(h, path, n, i + 1, victim->addr, 1);
+    }
+    else {
+        h->mem_writes++;
+    }
+}
+
+static void fill(hier_t *h, const int *path, int n, int i, unsigned long long address, int dirty) {
+    cache_victim_t victim;
+
+    cache_fill(&h->level[path[i]].cache, address, dirty, &victim);
+    if(victim.valid) {
+        evicted(h, path, n, i, &victim);
+    }
+}
+
+// demand - Look address up from path[i] down. Returns the cycles spent;
+// under exclusion a block moved up from below leaves its dirty bit in *dirty.
+static unsigned long long demand(hier_t *h, const int *path, int n, int i,
+                                 unsigned long long address, int write, int *dirty) {
+    level_t *l = &h->level[path[i]];
+    unsigned long long cycles = l->latency;
+    int exclusive = h->policy == HIER_EXCLUSIVE && i > 0;
+
+    if(cache_lookup(&l->cache, address, write)) {
+        if(exclusive) {
+            cache_remove(&l->cache, address, dirty);
+        }
+        return cycles;
+    }
+
+    int below_dirty = 0;
+    if(i + 1 < n) {
+        cycles += demand(h, path, n, i + 1, address, 0, &below_dirty);
+    }
+    else {
+        cycles += h->mem_latency;
+        h->mem_reads++;
+    }
+
+    if(exclusive) {
+        *dirty = below_dirty;
+    }
+    else {
+        fill(h, path, n, i, address, write || below_dirty);
+    }
+    return cycles;
+}
+
+void hier_access(hier_t *h, unsigned long long address, char op) {
+    const int *path = op == 'I' ? h->ipath : h->dpath;
+    int n = op == 'I' ? h->ilen : h->dlen;
+    int dirty = 0;
+
+    if(n == 0) {
+        return;
+    }
+    // A modify is a load followed by a store to the same address
+    h->accesses++;
+    h->cycles += demand(h, path, n, 0, address, op == 'S', &dirty);
+    if(op == 'M') {
+        h->accesses++;
+        h->cycles += demand(h, path, n, 0, address, 1, &dirty);
+    }
+}
+
+void hier_report(const hier_t *h, FILE *fp) {
+    static const char *policies[] = { "nine", "inclusive", "exclusive" };
+
+    fprintf(fp, "policy: %s, replacement: %s, memory latency %d\n", policies[h->policy],
+            cache_policy_name(h->replacement), h->mem_latency);
+    for(int i = 0; i < h->nlevels; i++) {
+        const level_t *l = &h->level[i];
+        const cache_t *c = &l->cache;
+        unsigned long long lookups = c->hits + c->misses;
+        fprintf(fp, "%-4s s=%d E=%d b=%d lat=%-3d hits:%llu misses:%llu evictions:%llu "
+                "writebacks:%llu", l->name, c->s, c->E, c->b, l->latency,
+                c->hits, c->misses, c->evictions, l->writebacks);
+        if(h->policy == HIER_INCLUSIVE) {
+            fprintf(fp, " invalidations:%llu", l->invalidations);
+        }
+        fprintf(fp, " miss rate:%.2f%%\n", lookups ? 100.0 * c->misses / lookups : 0.0);
+    }
+    fprintf(fp, "memory reads:%llu writes:%llu\n", h->mem_reads, h->mem_writes);
+    fprintf(fp, "AMAT: %.2f cycles over %llu accesses\n",
+            h->accesses ? (double)h->cycles / h->accesses : 0.0, h->accesses);
+}
+
+void hier_free(hier_t *h) {
+    for(int i = 0; i < h->nlevels; i++) {
+        cache_free(&h->level[i].cache);
+    }
+    free(h);
+}
@@ -0,0 +1,46 @@
+/*
+ * csim-hier.h - Multi-level cache hierarchy built from csim-cache levels
+ */
+
+#ifndef CSIM_HIER_H
+#define CSIM_HIER_H
+
+#include <stdio.h>
+
+// How the contents of neighbouring levels relate
+typedef enum {
+    HIER_NINE,                  // neither inclusive nor exclusive
+    HIER_INCLUSIVE,             // a lower level eviction invalidates the copies above
+    HIER_EXCLUSIVE              // a block lives in one level only, victims move down
+} hier_policy_t;
+
+#define HIER_MAX_LEVELS 8
+
+typedef struct hier hier_t;
+
+// hier_create - Empty hierarchy in front of a memory of the given latency,
+// every level replacing with the given cache_policy_t
+hier_t *hier_create(hier_policy_t policy, int mem_latency, int replacement);
+
+// hier_add_level - Append a level described as name:s:E:b:latency, top
+// level first. A level named L1I only sees instruction fetches and the
+// first other level only sees data; everything below is shared.
+// Exclusive hierarchies need every level to have the same b.
+// Returns -1 with a message in err on a bad spec.
+int hier_add_level(hier_t *h, const char *spec, char *err, size_t err_len);
+
+// hier_parse_policy - "nine", "inclusive" or "exclusive", -1 otherwise
+int hier_parse_policy(const char *name);
+
+// hier_has_icache - Whether instruction fetches are simulated at all
+int hier_has_icache(const hier_t *h);
+
+// hier_access - One trace record: 'I', 'L', 'S' or 'M'
+void hier_access(hier_t *h, unsigned long long address, char op);
+
+// hier_report - Per-level counts, memory traffic and AMAT
+void hier_report(const hier_t *h, FILE *fp);
+
+void hier_free(hier_t *h);
+
+#endif /* CSIM_HIER_H */
@@ -0,0 +1,131 @@
+/*
+ * csim-lib.c - Reentrant cache simulator handle for embedding csim
+ *
+ * A csim_t is a cache_t plus what csim's front end used to keep in
+ * globals: the -B split setting, the modify count (whose store halves
+ * are hits the cache never sees) and a buffer for flattening records
+ * into block addresses before handing them to cache_access_batch().
+ */
+#include <stdlib.h>
+#include "csim-lib.h"
+
+#define CSIM_BATCH 4096         // block addresses flattened per cache_access_batch()
+
+struct csim {
+    cache_t cache;
+    int split;
+    unsigned long long modifies;
+    csim_hook_t hook;
+    void *hook_arg;
+    unsigned long long addrs[CSIM_BATCH];
+};
+
+csim_t *csim_create(const csim_config_t *cfg) {
+    csim_t *sim;
+
+    if((sim = malloc(sizeof(csim_t))) == NULL) {
+        return NULL;
+    }
+    if(cache_init(&sim->cache, cfg->s, cfg->E, cfg->b) < 0) {
+        free(sim);
+        return NULL;
+    }
+    if(cache_set_policy(&sim->cache, cfg->policy) < 0) {
+        csim_free(sim);
+        return NULL;
+    }
+    sim->split = cfg->split;
+    sim->modifies = 0;
+    sim->hook = NULL;
+    sim->hook_arg = NULL;
+    return sim;
+}
+
+void csim_free(csim_t *sim) {
+    cache_free(&sim->cache);
+    free(sim);
+}
+
+void csim_set_hook(csim_t *sim, csim_hook_t hook, void *arg) {
+    sim->hook = hook;
+    sim->hook_arg = arg;
+}
+
+// Access one block on the slow path, reporting it to the hook
+static inline int Touch(csim_t *sim, unsigned long long address) {
+    cache_victim_t victim;
+    int result = cache_access(&sim->cache, address, 0, &victim);
+
+    if(sim->hook != NULL) {
+        sim->hook(sim->hook_arg, &sim->cache, address, result, &victim);
+    }
+    return result == CACHE_MISS;
+}
+
+int csim_access(csim_t *sim, unsigned long long address, unsigned int size, char op) {
+    int b = sim->cache.b;
+    unsigned long long first = address >> b, last = first;
+    int misses = 0;
+
+    if(op == 'I') {
+        return 0;
+    }
+    if(op != 'L' && op != 'S' && op != 'M') {
+        return -1;
+    }
+    if(sim->split && size > 1) {
+        last = (address + size - 1) >> b;
+    }
+    for(unsigned long long block = first; block <= last; block++) {
+        misses += Touch(sim, block == first ? address : block << b);
+        sim->modifies += op == 'M';
+    }
+    return misses;
+}
+
+// Run the flattened block addresses through the cache
+static void Apply(csim_t *sim, size_t n) {
+    if(sim->hook != NULL) {
+        for(size_t i = 0; i < n; i++) {
+            Touch(sim, sim->addrs[i]);
+        }
+        return;
+    }
+    cache_access_batch(&sim->cache, sim->addrs, n);
+}
+
+void csim_access_batch(csim_t *sim, const trace_rec_t *recs, size_t n) {
+    int b = sim->cache.b;
+    size_t m = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        if(recs[i].op == 'I') {
+            continue;
+        }
+
+        unsigned long long addr = recs[i].addr;
+        unsigned long long first = addr >> b, last = first;
+        if(sim->split && recs[i].size > 1) {
+            last = (addr + recs[i].size - 1) >> b;
+        }
+        for(unsigned long long block = first; block <= last; block++) {
+            sim->addrs[m++] = block == first ? addr : block << b;
+            sim->modifies += recs[i].op == 'M';
+            if(m == CSIM_BATCH) {
+                Apply(sim, m);
+                m = 0;
+            }
+        }
+    }
+    Apply(sim, m);
+}
+
+void csim_counts(const csim_t *sim, csim_counts_t *out) {
+    out->hits = sim->cache.hits + sim->modifies;
+    out->misses = sim->cache.misses;
+    out->evictions = sim->cache.evictions;
+}
+
+cache_t *csim_cache(csim_t *sim) {
+    return &sim->cache;
+}
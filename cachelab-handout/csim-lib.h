@@ -0,0 +1,67 @@
+/*
+ * csim-lib.h - Reentrant cache simulator handle for embedding csim
+ *
+ * Everything a run needs lives in the csim_t, so any number of caches
+ * can be simulated side by side, one per thread if need be, without
+ * fork/exec or trace files:
+ *
+ *     csim_config_t cfg = { .s = 5, .E = 1, .b = 5, .policy = CACHE_LRU };
+ *     csim_t *sim = csim_create(&cfg);
+ *     csim_access(sim, addr, 4, 'L');
+ *     csim_counts(sim, &counts);
+ *     csim_free(sim);
+ */
+
+#ifndef CSIM_LIB_H
+#define CSIM_LIB_H
+
+#include <stddef.h>
+#include "csim-cache.h"
+#include "csim-trace.h"
+
+typedef struct {
+    int s, E, b;
+    int policy;                 // a cache_policy_t; CACHE_OPT also needs the
+                                // caller to set csim_cache()->next_use
+    int split;                  // count one access per block an access touches
+} csim_config_t;
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} csim_counts_t;
+
+// Called for every block access csim_t makes, with cache_access()'s
+// result and victim; see csim_set_hook()
+typedef void (*csim_hook_t)(void *arg, cache_t *c, unsigned long long address,
+                            int result, const cache_victim_t *victim);
+
+typedef struct csim csim_t;
+
+// csim_create - An empty cache. Returns NULL if out of memory or if the
+// policy does not suit E.
+csim_t *csim_create(const csim_config_t *cfg);
+
+void csim_free(csim_t *sim);
+
+// csim_set_hook - Have every access reported to hook, e.g. to drive a
+// prefetcher. Hooked handles skip the batched fast path.
+void csim_set_hook(csim_t *sim, csim_hook_t hook, void *arg);
+
+// csim_access - One lackey record: op is 'L', 'S' or 'M' ('I' is
+// ignored). A modify's store half always hits. Returns the number of
+// misses it caused, or -1 for an unknown op.
+int csim_access(csim_t *sim, unsigned long long address, unsigned int size, char op);
+
+// csim_access_batch - csim_access() for n records in order, with the
+// cache fetching sets ahead of the accesses that need them
+void csim_access_batch(csim_t *sim, const trace_rec_t *recs, size_t n);
+
+// csim_counts - Hits, misses and evictions so far
+void csim_counts(const csim_t *sim, csim_counts_t *out);
+
+// csim_cache - The underlying level, for reports and hooks
+cache_t *csim_cache(csim_t *sim);
+
+#endif /* CSIM_LIB_H */
@@ -0,0 +1,183 @@
+/*
+ * csim-par.c - Set-partitioned multithreaded simulation of one cache level
+ *
+ * Sets never interact, so the cache can be cut into slices of sets that
+ * are simulated independently. The calling thread decodes the trace and
+ * appends each address to the batch of the worker owning its set; full
+ * batches go through a small per-worker queue, and drained ones come
+ * back through another so no batch memory is allocated after startup.
+ *
+ * Each worker runs cache_access() on its own copy of the cache_t: the
+ * tag/state arrays are shared, but the clock, counters and random state
+ * are private, and no two workers ever touch the same set. Per-set
+ * order is kept, so every deterministic policy gives the serial counts.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include "csim-par.h"
+
+#define PAR_BATCH 4096          // addresses per batch
+#define PAR_DEPTH 8             // batches per worker, so no queue ever overflows
+
+typedef struct {
+    unsigned long long addr[PAR_BATCH];
+    int n;                      // 0 tells the worker to finish
+} batch_t;
+
+// Bounded FIFO of batch pointers
+typedef struct {
+    batch_t *slot[PAR_DEPTH];
+    int head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} queue_t;
+
+typedef struct {
+    cache_t view;               // private clock and counters, shared arrays
+    queue_t full;               // reader -> worker
+    queue_t empty;              // worker -> reader
+    batch_t *filling;           // batch the reader is appending to
+    pthread_t tid;
+} worker_t;
+
+static void QueueInit(queue_t *q) {
+    q->head = q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+}
+
+static void QueueDestroy(queue_t *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+}
+
+static void QueuePut(queue_t *q, batch_t *b) {
+    pthread_mutex_lock(&q->lock);
+    while(q->count == PAR_DEPTH) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    q->slot[(q->head + q->count) % PAR_DEPTH] = b;
+    q->count++;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static batch_t *QueueGet(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    while(q->count == 0) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    batch_t *b = q->slot[q->head];
+    q->head = (q->head + 1) % PAR_DEPTH;
+    q->count--;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
+
+static void *Worker(void *arg) {
+    worker_t *w = arg;
+    cache_victim_t victim;
+
+    for(;;) {
+        batch_t *b = QueueGet(&w->full);
+        int n = b->n;
+        for(int i = 0; i < n; i++) {
+            cache_access(&w->view, b->addr[i], 0, &victim);
+        }
+        QueuePut(&w->empty, b);
+        if(n == 0) {
+            return NULL;
+        }
+    }
+}
+
+// Hand w's current batch over and start on an empty one
+static void Flush(worker_t *w) {
+    QueuePut(&w->full, w->filling);
+    w->filling = QueueGet(&w->empty);
+    w->filling->n = 0;
+}
+
+int par_simulate(cache_t *c, trace_reader_t *tr, int nthreads, unsigned long long *modifies) {
+    unsigned long long sets = 1ULL << c->s;
+    worker_t *workers;
+    batch_t *batches;
+    int started = 0;
+
+    if(nthreads > PAR_MAX_THREADS) {
+        nthreads = PAR_MAX_THREADS;
+    }
+    if((unsigned long long)nthreads > sets) {
+        nthreads = sets;
+    }
+    workers = calloc(nthreads, sizeof(worker_t));
+    batches = malloc((size_t)nthreads * PAR_DEPTH * sizeof(batch_t));
+    if(workers == NULL || batches == NULL) {
+        free(workers);
+        free(batches);
+        return -1;
+    }
+
+    for(int t = 0; t < nthreads; t++) {
+        worker_t *w = &workers[t];
+        w->view = *c;
+        w->view.hits = w->view.misses = w->view.evictions = 0;
+        w->view.rng += t;
+        QueueInit(&w->full);
+        QueueInit(&w->empty);
+        // One batch is being filled, the rest start out empty
+        for(int k = 0; k < PAR_DEPTH - 1; k++) {
+            w->empty.slot[k] = &batches[t * PAR_DEPTH + k];
+        }
+        w->empty.count = PAR_DEPTH - 1;
+        w->filling = &batches[t * PAR_DEPTH + PAR_DEPTH - 1];
+        w->filling->n = 0;
+    }
+    for(; started < nthreads; started++) {
+        if(pthread_create(&workers[started].tid, NULL, Worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+
+    // Set i belongs to worker i * nthreads / sets: contiguous slices
+    trace_rec_t recs[PAR_BATCH];
+    size_t n;
+    *modifies = 0;
+    while(started == nthreads && (n = trace_read(tr, recs, PAR_BATCH)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            if(recs[i].op == 'I') {
+                continue;
+            }
+            *modifies += recs[i].op == 'M';
+            unsigned long long set_index = (recs[i].addr >> c->b) & (sets - 1);
+            worker_t *w = &workers[set_index * nthreads >> c->s];
+            w->filling->addr[w->filling->n++] = recs[i].addr;
+            if(w->filling->n == PAR_BATCH) {
+                Flush(w);
+            }
+        }
+    }
+
+    for(int t = 0; t < started; t++) {
+        worker_t *w = &workers[t];
+        if(w->filling->n > 0) {
+            Flush(w);
+        }
+        QueuePut(&w->full, w->filling);     // n == 0: finish
+    }
+    for(int t = 0; t < started; t++) {
+        pthread_join(workers[t].tid, NULL);
+        c->hits += workers[t].view.hits;
+        c->misses += workers[t].view.misses;
+        c->evictions += workers[t].view.evictions;
+    }
+    for(int t = 0; t < nthreads; t++) {
+        QueueDestroy(&workers[t].full);
+        QueueDestroy(&workers[t].empty);
+    }
+    free(workers);
+    free(batches);
+    return started == nthreads ? 0 : -1;
+}
@@ -0,0 +1,20 @@
+/*
+ * csim-par.h - Set-partitioned multithreaded simulation of one cache level
+ */
+
+#ifndef CSIM_PAR_H
+#define CSIM_PAR_H
+
+#include "csim-cache.h"
+#include "csim-trace.h"
+
+#define PAR_MAX_THREADS 64
+
+// par_simulate - Run every data record of tr through c using nthreads
+// workers, each owning a contiguous slice of the sets, and add their
+// counts into c. The store half of each modify is left to the caller,
+// which gets the number of modifies in *modifies. Returns -1 if the
+// threads or their buffers cannot be set up.
+int par_simulate(cache_t *c, trace_reader_t *tr, int nthreads, unsigned long long *modifies);
+
+#endif /* CSIM_PAR_H */
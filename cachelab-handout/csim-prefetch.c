@@ -0,0 +1,243 @@
+/*
+ * csim-prefetch.c - Hardware prefetcher models in front of a csim-cache level
+ *
+ * Three models, all working on block numbers (address >> b):
+ *
+ *   next    on a miss, or the first use of a prefetched block (tagged
+ *           prefetching), fetch blocks B + distance .. B + distance +
+ *           degree - 1
+ *   stride  a table indexed by 4 KB page remembers the last block seen
+ *           there and the delta to it; once the same nonzero delta has
+ *           been seen STRIDE_CONFIDENT times in a row, fetch degree
+ *           blocks starting distance strides ahead
+ *   stream  up to NSTREAMS streams; a miss within STREAM_WINDOW blocks
+ *           after (or before) a stream's last block confirms a direction,
+ *           and a confirmed stream runs degree blocks ahead of its head,
+ *           starting distance blocks away
+ *
+ * Prefetched lines are flagged in the cache. Their first demand hit
+ * counts as useful; eviction before any use counts as useless. Blocks
+ * thrown out by prefetch fills go into a small filter, and a demand miss
+ * that hits the filter is counted as pollution.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csim-prefetch.h"
+
+#define STRIDE_ENTRIES 256
+#define STRIDE_CONFIDENT 2
+#define NSTREAMS 16
+#define STREAM_WINDOW 16
+#define POLLUTION_ENTRIES 4096
+
+enum { PF_NEXT, PF_STRIDE, PF_STREAM };
+
+typedef struct {
+    unsigned long long page;
+    unsigned long long last;    // last block seen in the page
+    long long delta;
+    int confidence;
+    int used;
+} stride_entry_t;
+
+typedef struct {
+    unsigned long long head;    // last block of the stream
+    int dir;                    // +1/-1 once confirmed, 0 while training
+    int used;
+    unsigned long long stamp;   // for LRU replacement of streams
+} stream_t;
+
+struct prefetcher {
+    int kind;
+    int degree;
+    int distance;
+
+    stride_entry_t stride[STRIDE_ENTRIES];
+    stream_t stream[NSTREAMS];
+    unsigned long long clock;
+
+    // block + 1 of recent prefetch victims, 0 = empty
+    unsigned long long pollution[POLLUTION_ENTRIES];
+
+    unsigned long long issued;      // blocks actually filled
+    unsigned long long redundant;   // candidates already cached
+    unsigned long long useful;      // first demand hits on prefetched lines
+    unsigned long long useless;     // prefetched lines evicted unused
+    unsigned long long polluting;   // demand misses caused by prefetch victims
+};
+
+prefetcher_t *prefetch_create(const char *spec, char *err, size_t err_len) {
+    char kind[16];
+    int degree = 1, distance = 1;
+    int n = sscanf(spec, "%15[^:]:%d:%d", kind, &degree, &distance);
+    prefetcher_t *pf;
+
+    if(n < 1 || degree < 1 || distance < 1) {
+        snprintf(err, err_len, "%s: expected kind[:degree[:distance]]", spec);
+        return NULL;
+    }
+    if((pf = calloc(1, sizeof(prefetcher_t))) == NULL) {
+        snprintf(err, err_len, "out of memory");
+        return NULL;
+    }
+    if(strcmp(kind, "next") == 0) {
+        pf->kind = PF_NEXT;
+    }
+    else if(strcmp(kind, "stride") == 0) {
+        pf->kind = PF_STRIDE;
+    }
+    else if(strcmp(kind, "stream") == 0) {
+        pf->kind = PF_STREAM;
+    }
+    else {
+        snprintf(err, err_len, "%s: unknown prefetcher (next, stride, stream)", kind);
+        free(pf);
+        return NULL;
+    }
+    pf->degree = degree;
+    pf->distance = distance;
+    return pf;
+}
+
+void prefetch_free(prefetcher_t *pf) {
+    free(pf);
+}
+
+static inline unsigned long long *PollutionSlot(prefetcher_t *pf, unsigned long long block) {
+    return &pf->pollution[(block * 0x9E3779B97F4A7C15ULL) >> 52 & (POLLUTION_ENTRIES - 1)];
+}
+
+// Fetch the block and account for what it pushed out
+static void Issue(prefetcher_t *pf, cache_t *c, unsigned long long block) {
+    cache_victim_t victim;
+
+    if(!cache_prefetch(c, block << c->b, &victim)) {
+        pf->redundant++;
+        return;
+    }
+    pf->issued++;
+    if(victim.valid) {
+        unsigned long long evicted = victim.addr >> c->b;
+        pf->useless += victim.prefetched;
+        *PollutionSlot(pf, evicted) = evicted + 1;
+    }
+}
+
+// Fetch degree blocks starting distance steps of step from block
+static void IssueRun(prefetcher_t *pf, cache_t *c, unsigned long long block, long long step) {
+    for(int k = 0; k < pf->degree; k++) {
+        Issue(pf, c, block + step * (pf->distance + k));
+    }
+}
+
+static void TrainStride(prefetcher_t *pf, cache_t *c, unsigned long long block) {
+    unsigned long long page = (block << c->b) >> 12;
+    stride_entry_t *e = &pf->stride[(page * 0x9E3779B97F4A7C15ULL) >> 56 & (STRIDE_ENTRIES - 1)];
+
+    if(!e->used || e->page != page) {
+        e->used = 1;
+        e->page = page;
+        e->last = block;
+        e->delta = 0;
+        e->confidence = 0;
+        return;
+    }
+
+    long long delta = block - e->last;
+    if(delta == 0) {
+        return;                 // same block again, nothing learned
+    }
+    if(delta == e->delta) {
+        if(e->confidence < STRIDE_CONFIDENT) {
+            e->confidence++;
+        }
+    }
+    else {
+        e->delta = delta;
+        e->confidence = 0;
+    }
+    e->last = block;
+    if(e->confidence >= STRIDE_CONFIDENT) {
+        IssueRun(pf, c, block, e->delta);
+    }
+}
+
+static void TrainStream(prefetcher_t *pf, cache_t *c, unsigned long long block) {
+    stream_t *oldest = &pf->stream[0];
+
+    pf->clock++;
+    for(int i = 0; i < NSTREAMS; i++) {
+        stream_t *st = &pf->stream[i];
+        if(!st->used) {
+            oldest = st;
+            continue;
+        }
+        long long ahead = block - st->head;
+        int dir = st->dir;
+        if(dir == 0 && ahead != 0 && llabs(ahead) <= STREAM_WINDOW) {
+            dir = ahead > 0 ? 1 : -1;
+        }
+        if(dir != 0 && ahead * dir > 0 && ahead * dir <= STREAM_WINDOW) {
+            st->dir = dir;
+            st->head = block;
+            st->stamp = pf->clock;
+            IssueRun(pf, c, block, dir);
+            return;
+        }
+        if(oldest->used && st->stamp < oldest->stamp) {
+            oldest = st;
+        }
+    }
+
+    oldest->used = 1;
+    oldest->head = block;
+    oldest->dir = 0;
+    oldest->stamp = pf->clock;
+}
+
+void prefetch_access(prefetcher_t *pf, cache_t *c, unsigned long long address,
+                     int result, const cache_victim_t *victim) {
+    unsigned long long block = address >> c->b;
+
+    if(result == CACHE_MISS) {
+        unsigned long long *slot = PollutionSlot(pf, block);
+        if(*slot == block + 1) {
+            pf->polluting++;
+            *slot = 0;
+        }
+    }
+    else if(result == CACHE_HIT_PREFETCHED) {
+        pf->useful++;
+    }
+    if(victim->valid && victim->prefetched) {
+        pf->useless++;
+    }
+
+    switch (pf->kind) {
+        case PF_NEXT:
+            if(result != CACHE_HIT) {
+                IssueRun(pf, c, block, 1);
+            }
+            break;
+        case PF_STRIDE:
+            TrainStride(pf, c, block);
+            break;
+        case PF_STREAM:
+            if(result != CACHE_HIT) {
+                TrainStream(pf, c, block);
+            }
+            break;
+    }
+}
+
+void prefetch_report(const prefetcher_t *pf, const cache_t *c, FILE *fp) {
+    static const char *kinds[] = { "next", "stride", "stream" };
+    unsigned long long wanted = pf->useful + c->misses;
+
+    fprintf(fp, "prefetch %s degree:%d distance:%d issued:%llu redundant:%llu useful:%llu "
+            "useless:%llu\n", kinds[pf->kind], pf->degree, pf->distance,
+            pf->issued, pf->redundant, pf->useful, pf->useless);
+    fprintf(fp, "accuracy:%.2f%% coverage:%.2f%% pollution misses:%llu\n",
+            pf->issued ? 100.0 * pf->useful / pf->issued : 0.0,
+            wanted ? 100.0 * pf->useful / wanted : 0.0, pf->polluting);
+}
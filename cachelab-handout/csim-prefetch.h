@@ -0,0 +1,29 @@
+/*
+ * csim-prefetch.h - Hardware prefetcher models in front of a csim-cache level
+ */
+
+#ifndef CSIM_PREFETCH_H
+#define CSIM_PREFETCH_H
+
+#include <stdio.h>
+#include "csim-cache.h"
+
+typedef struct prefetcher prefetcher_t;
+
+// prefetch_create - Prefetcher from kind[:degree[:distance]], kind being
+// next (next-line), stride (per-page address delta table) or stream.
+// Returns NULL with a message in err on a bad spec.
+prefetcher_t *prefetch_create(const char *spec, char *err, size_t err_len);
+
+// prefetch_access - Account for one demand access that cache_access()
+// answered with result (and victim), then train and issue prefetches
+void prefetch_access(prefetcher_t *pf, cache_t *c, unsigned long long address,
+                     int result, const cache_victim_t *victim);
+
+// prefetch_report - Issued/useful/useless prefetches, accuracy, coverage
+// and pollution, kept apart from the demand counts
+void prefetch_report(const prefetcher_t *pf, const cache_t *c, FILE *fp);
+
+void prefetch_free(prefetcher_t *pf);
+
+#endif /* CSIM_PREFETCH_H */
@@ -0,0 +1,309 @@
+/*
+ * csim-sample.c - Estimate cache counts from part of the sets or the trace
+ *
+ * Set sampling keeps every access to the sets whose hashed index is 0
+ * mod set_ratio and drops the rest. Sets do not interact, so the
+ * sampled ones behave exactly as in a full run. Accesses cluster in a
+ * few sets in real traces (the stack often takes most of them), and no
+ * estimate built from the other sets can see how those behave, so the
+ * sets are stratified: a set that has taken more than SAMPLE_HOT_SHARE
+ * times its share of the records so far turns hot and is simulated exactly
+ * from then on. The price is speed: on a trace where a few sets take
+ * most of the accesses, most of the accesses are still simulated and
+ * -S saves little over a full run (capping the hot sets instead would
+ * leave them to an estimate that cannot see them). Everything else,
+ * including what a hot set saw before it turned, is estimated with a
+ * ratio estimator: the per-record rate of the sampled sets times the
+ * number of records, which is known exactly.
+ * Its standard error is N * sqrt(var(d) / n * (1 - n / N)) over the N
+ * sets of the stratum, where d = count - rate * records for each of the
+ * n sampled ones.
+ *
+ * Time sampling runs and counts exactly every access to a set that
+ * still has a free line, so cold-start misses are counted rather than
+ * scaled, and sets the trace rarely touches never hold the run up. The
+ * accesses to full sets are walked in periods: the first warmup records
+ * of a period are simulated to bring the cache to a realistic state,
+ * the next window are simulated and counted, and the rest are skipped
+ * without touching the cache. Once fewer than 1 in SAMPLE_COLD_SHARE
+ * of a period's accesses still find a free line, the skipped stretch
+ * is passed over with trace_skip(), which does not decode it (whole
+ * blocks of a binary trace are not even inflated); the few fills it
+ * hides are left to the warmup. Each window gives a per-record rate;
+ * the estimate is the pooled rate times the number of accesses outside
+ * the exact ones, and the interval comes from the spread of the
+ * per-window rates.
+ *
+ * A modify counts as one record with a hit for its store half, as in a
+ * full run.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "csim-sample.h"
+
+#define SAMPLE_BATCH 4096
+#define Z95 1.96
+#define SAMPLE_HOT_LINES 8
+#define SAMPLE_HOT_SHARE 2
+#define SAMPLE_COLD_SHARE 100
+
+typedef struct {
+    unsigned long long hits, misses, evictions, records;
+} tally_t;
+
+typedef struct {
+    tally_t tally;
+    unsigned long long seen;            // records mapping to the set
+    unsigned long long before;          // records it saw before it turned hot
+    int hot;
+} set_state_t;
+
+int sample_parse_time(sample_cfg_t *cfg, const char *spec) {
+    int len;
+
+    if(sscanf(spec, "%lld:%lld:%lld%n", &cfg->period, &cfg->warmup, &cfg->window, &len) != 3 ||
+       spec[len] != '\0' || cfg->window <= 0 || cfg->warmup < 0 ||
+       cfg->warmup + cfg->window > cfg->period) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int SetSampled(unsigned long long set_index, int ratio) {
+    return (set_index * 0x9E3779B97F4A7C15ULL >> 32) % ratio == 0;
+}
+
+static inline void Tally(tally_t *t, cache_t *c, const trace_rec_t *rec) {
+    cache_victim_t victim;
+    int result = cache_access(c, rec->addr, 0, &victim);
+
+    t->hits += (result != CACHE_MISS) + (rec->op == 'M');
+    t->misses += result == CACHE_MISS;
+    t->evictions += victim.valid;
+    t->records++;
+}
+
+// Hits, misses or evictions of t, by index
+static inline double TallyField(const tally_t *t, int k) {
+    return k == 0 ? t->hits : k == 1 ? t->misses : t->evictions;
+}
+
+// The mean and half-interval of n samples, from their sum and sum of squares
+static void Interval(double sum, double sumsq, double n, double *mean, double *half) {
+    *mean = sum / n;
+    double var = n > 1 ? (sumsq - sum * sum / n) / (n - 1) : 0;
+    *half = Z95 * sqrt(var > 0 ? var / n : 0);
+}
+
+static int RunSets(cache_t *c, trace_reader_t *tr, int ratio, sample_result_t *out) {
+    unsigned long long sets = 1ULL << c->s;
+    unsigned long long set_mask = sets - 1;
+    unsigned long long hot_min = (unsigned long long)SAMPLE_HOT_LINES * c->E;
+    set_state_t *set = calloc(sets, sizeof(set_state_t));
+    trace_rec_t recs[SAMPLE_BATCH];
+    size_t n;
+
+    if(set == NULL) {
+        return -1;
+    }
+    while((n = trace_read(tr, recs, SAMPLE_BATCH)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            if(recs[i].op == 'I') {
+                continue;
+            }
+            out->records++;
+            unsigned long long set_index = (recs[i].addr >> c->b) & set_mask;
+            set_state_t *st = &set[set_index];
+            st->seen++;
+            if(!st->hot && st->seen > hot_min && st->seen * sets > out->records * SAMPLE_HOT_SHARE) {
+                st->hot = 1;
+                st->before = st->seen - 1;
+            }
+            if(st->hot || SetSampled(set_index, ratio)) {
+                Tally(&st->tally, c, &recs[i]);
+                out->simulated++;
+            }
+        }
+    }
+
+    // Hot sets are counted exactly from the moment they turned hot; the
+    // other sets are the sampled stratum
+    double exact[3] = { 0 }, y[3] = { 0 };
+    double x = 0, pop_records = 0, pop_sets = 0, sampled_sets = 0, late = 0, early = 0;
+    for(unsigned long long i = 0; i < sets; i++) {
+        int sampled = SetSampled(i, ratio);
+        if(set[i].hot) {
+            for(int k = 0; k < 3; k++) {
+                exact[k] += TallyField(&set[i].tally, k);
+            }
+            out->units++;
+            late += !sampled;
+            early += sampled ? 0 : set[i].before;
+            continue;
+        }
+        pop_sets++;
+        pop_records += set[i].seen;
+        if(sampled) {
+            for(int k = 0; k < 3; k++) {
+                y[k] += TallyField(&set[i].tally, k);
+            }
+            x += set[i].seen;
+            sampled_sets++;
+        }
+    }
+    out->units += sampled_sets;
+    if(x == 0 && pop_records + early > 0) {
+        free(set);
+        return -1;
+    }
+
+    estimate_t *est[3] = { &out->hits, &out->misses, &out->evictions };
+    double fpc = pop_sets > 0 ? 1.0 - sampled_sets / pop_sets : 0;
+    for(int k = 0; k < 3; k++) {
+        double rate = x > 0 ? y[k] / x : 0, sum = 0, sumsq = 0, mean, half = 0;
+        for(unsigned long long i = 0; i < sets; i++) {
+            if(!set[i].hot && SetSampled(i, ratio)) {
+                double d = TallyField(&set[i].tally, k) - rate * set[i].seen;
+                sum += d;
+                sumsq += d * d;
+            }
+        }
+        if(sampled_sets > 0) {
+            Interval(sum, sumsq, sampled_sets, &mean, &half);
+        }
+        est[k]->value = exact[k] + rate * (pop_records + early);
+        // The sampled sets say nothing about how a hot set did before it
+        // turned, so those records get a worst-case bound (a modify can
+        // hit twice). After it turned, it started from empty lines: at
+        // most E accesses counted as misses would have hit, or evicted,
+        // in a full run.
+        double most = k == 0 ? 2 : 1;
+        est[k]->ci = half * sqrt(fpc) * pop_sets + early * fmax(rate, most - rate) + late * c->E;
+    }
+    free(set);
+    return 0;
+}
+
+// Fold one finished window into the running sums of per-record rates
+static void AddWindow(tally_t *window, tally_t *total, double sum[3], double sumsq[3],
+                      unsigned long long *units) {
+    double r[3] = {
+        (double)window->hits / window->records,
+        (double)window->misses / window->records,
+        (double)window->evictions / window->records
+    };
+    for(int k = 0; k < 3; k++) {
+        sum[k] += r[k];
+        sumsq[k] += r[k] * r[k];
+    }
+    total->hits += window->hits;
+    total->misses += window->misses;
+    total->evictions += window->evictions;
+    total->records += window->records;
+    (*units)++;
+    *window = (tally_t) { 0 };
+}
+
+static int RunTime(cache_t *c, trace_reader_t *tr, const sample_cfg_t *cfg, sample_result_t *out) {
+    unsigned long long set_mask = (1ULL << c->s) - 1;
+    int *fills = calloc(set_mask + 1, sizeof(int));
+    trace_rec_t recs[SAMPLE_BATCH];
+    cache_victim_t victim;
+    tally_t cold = { 0 }, window = { 0 }, total = { 0 };
+    double sum[3] = { 0 }, sumsq[3] = { 0 };
+    unsigned long long sampled_records = 0;
+    long long pos = 0, skip_at = cfg->warmup + cfg->window, cold_in_period = 0;
+    int blind = 0;
+    size_t n;
+
+    if(fills == NULL) {
+        return -1;
+    }
+    while(1) {
+        // Once the cache has settled, the rest of a period is passed over
+        // without even decoding it
+        if(blind && pos >= skip_at) {
+            size_t skipped = trace_skip(tr, cfg->period - pos);
+            out->records += skipped;
+            sampled_records += skipped;
+            pos += skipped;
+            if(pos < cfg->period) {
+                break;
+            }
+            AddWindow(&window, &total, sum, sumsq, &out->units);
+            pos = 0;
+            continue;
+        }
+        size_t want = blind && skip_at - pos < SAMPLE_BATCH ? skip_at - pos : SAMPLE_BATCH;
+        if((n = trace_read(tr, recs, want)) == 0) {
+            break;
+        }
+        for(size_t i = 0; i < n; i++) {
+            if(recs[i].op == 'I') {
+                continue;
+            }
+            out->records++;
+            out->simulated++;
+            // An access to a set with a free line is run and counted
+            // exactly: compulsory misses happen once per run and must not
+            // be scaled, and skipping it would leave the set emptier than
+            // the warmup can make up for
+            int *set_fills = &fills[(recs[i].addr >> c->b) & set_mask];
+            if(*set_fills < c->E) {
+                unsigned long long misses = cold.misses;
+                Tally(&cold, c, &recs[i]);
+                *set_fills += cold.misses > misses;
+                cold_in_period++;
+                continue;
+            }
+            sampled_records++;
+            if(pos < cfg->warmup) {
+                cache_access(c, recs[i].addr, 0, &victim);
+            }
+            else if(pos < cfg->warmup + cfg->window) {
+                Tally(&window, c, &recs[i]);
+            }
+            else {
+                out->simulated--;
+            }
+            if(++pos == cfg->period) {
+                AddWindow(&window, &total, sum, sumsq, &out->units);
+                pos = 0;
+                blind = cold_in_period * SAMPLE_COLD_SHARE < cfg->period;
+                cold_in_period = 0;
+            }
+        }
+    }
+    // A trailing partial window still counts if it got past the warmup
+    if(window.records > 0) {
+        AddWindow(&window, &total, sum, sumsq, &out->units);
+    }
+    free(fills);
+    if(total.records == 0 && sampled_records > 0) {
+        return -1;
+    }
+
+    estimate_t *est[3] = { &out->hits, &out->misses, &out->evictions };
+    double exact[3] = { cold.hits, cold.misses, cold.evictions };
+    double pooled[3] = { total.hits, total.misses, total.evictions };
+    for(int k = 0; k < 3; k++) {
+        double mean, half;
+        est[k]->value = exact[k];
+        est[k]->ci = 0;
+        if(out->units > 0) {
+            Interval(sum[k], sumsq[k], out->units, &mean, &half);
+            est[k]->value += pooled[k] / total.records * sampled_records;
+            est[k]->ci = half * sampled_records;
+        }
+    }
+    return 0;
+}
+
+int sample_run(cache_t *c, trace_reader_t *tr, const sample_cfg_t *cfg, sample_result_t *out) {
+    *out = (sample_result_t) { { 0 } };
+    if(cfg->set_ratio > 1) {
+        return RunSets(c, tr, cfg->set_ratio, out);
+    }
+    return RunTime(c, tr, cfg, out);
+}
@@ -0,0 +1,38 @@
+/*
+ * csim-sample.h - Estimate cache counts from part of the sets or the trace
+ */
+
+#ifndef CSIM_SAMPLE_H
+#define CSIM_SAMPLE_H
+
+#include "csim-cache.h"
+#include "csim-trace.h"
+
+typedef struct {
+    int set_ratio;              // simulate about 1 set in set_ratio, 0 = all
+    long long period;           // time sampling: every period records...
+    long long warmup;           // ...simulate warmup records uncounted...
+    long long window;           // ...then count window records, skip the rest
+} sample_cfg_t;
+
+// An estimate and the half-width of its 95% confidence interval
+typedef struct {
+    double value;
+    double ci;
+} estimate_t;
+
+typedef struct {
+    estimate_t hits, misses, evictions;
+    unsigned long long records;         // L/S/M records in the trace
+    unsigned long long simulated;       // records that reached the cache
+    unsigned long long units;           // sets or windows the estimate is built from
+} sample_result_t;
+
+// sample_parse_time - Fill period, warmup and window from period:warmup:window
+int sample_parse_time(sample_cfg_t *cfg, const char *spec);
+
+// sample_run - Run tr through c under cfg and estimate the full-run counts.
+// Returns -1 if out of memory or if the sample came out empty.
+int sample_run(cache_t *c, trace_reader_t *tr, const sample_cfg_t *cfg, sample_result_t *out);
+
+#endif /* CSIM_SAMPLE_H */
@@ -0,0 +1,297 @@
+/*
+ * csim-sweep.c - One-pass LRU simulation of many cache geometries
+ *
+ * Each distinct block gets a small integer id. For every set count the
+ * sweep keeps, per set, a treap of the blocks that map there keyed by
+ * the time of their last access. On an access the number of keys newer
+ * than the block's own is its stack distance: the distinct blocks of
+ * the same set touched since it was last used. Its key then moves to
+ * the current time, which is always the largest, so it goes back in at
+ * the right edge.
+ *
+ * Only distances below e_max are told apart, so a treap never needs
+ * more than the e_max most recent blocks of its set: the oldest one
+ * drops out (its key goes to 0) once there are more, and a block coming
+ * back from there counts as distance >= e_max. That keeps every treap a
+ * few levels deep however large the trace.
+ *
+ * A miss evicts exactly when the set already held E blocks. For reuses
+ * with distance >= E that is always so; for first touches it depends on
+ * how many blocks the set had seen, which is the size of its treap
+ * (capped at e_max like everything else). Both are histogrammed per set
+ * count.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "csim-sweep.h"
+
+// Node 0 is the empty tree, its size stays 0
+typedef struct {
+    unsigned long long key;     // time of the block's last access, 0 if not in its treap
+    int left, right;
+    int size;                   // nodes in this subtree
+} node_t;
+
+struct sweep {
+    int s_max, e_max, b;
+
+    // block number -> id, open addressing, id 0 marks an empty slot
+    unsigned long long *slot_block;
+    int *slot_id;
+    size_t slots;
+    int nblocks;
+
+    // per block, shared by all levels
+    unsigned int *prio;
+    int capacity;               // ids allocated in every level's node array
+
+    node_t **nodes;             // [s] -> nodes by block id
+    int **root;                 // [s] -> treap root per set
+
+    unsigned long long clock;
+    unsigned long long rng;
+    // [s * (e_max + 1) + d], the last bucket collects everything >= e_max
+    unsigned long long *reuse;  // reuses by stack distance d
+    unsigned long long *cold;   // first touches by blocks already in the set
+};
+
+static inline int size_of(const node_t *n, int t) {
+    return n[t].size;
+}
+
+static inline void pull(node_t *n, int t) {
+    n[t].size = 1 + n[n[t].left].size + n[n[t].right].size;
+}
+
+// split - Cut t into keys < key (*l) and keys >= key (*r)
+static void split(node_t *n, int t, unsigned long long key, int *l, int *r) {
+    if(t == 0) {
+        *l = *r = 0;
+        return;
+    }
+    if(n[t].key < key) {
+        split(n, n[t].right, key, &n[t].right, r);
+        *l = t;
+    }
+    else {
+        split(n, n[t].left, key, l, &n[t].left);
+        *r = t;
+    }
+    pull(n, t);
+}
+
+// merge - Join two treaps where every key in l is below every key in r
+static int merge(node_t *n, const unsigned int *prio, int l, int r) {
+    if(l == 0 || r == 0) {
+        return l | r;
+    }
+    if(prio[l] > prio[r]) {
+        n[l].right = merge(n, prio, n[l].right, r);
+        pull(n, l);
+        return l;
+    }
+    n[r].left = merge(n, prio, l, n[r].left);
+    pull(n, r);
+    return r;
+}
+
+// insert_newest - Add id with the current time, dropping the set's oldest
+// block if that leaves more than e_max
+static void insert_newest(sweep_t *sw, node_t *n, int *root, int id) {
+    n[id].key = sw->clock;
+    n[id].left = n[id].right = 0;
+    n[id].size = 1;
+    *root = merge(n, sw->prio, *root, id);
+
+    if(n[*root].size > sw->e_max) {
+        int oldest = *root, rest;
+        while(n[oldest].left != 0) {
+            oldest = n[oldest].left;
+        }
+        split(n, *root, n[oldest].key + 1, &oldest, &rest);
+        n[oldest].key = 0;
+        *root = rest;
+    }
+}
+
+sweep_t *sweep_create(int s_max, int e_max, int b) {
+    sweep_t *sw = calloc(1, sizeof(sweep_t));
+    size_t buckets = (size_t)(s_max + 1) * (e_max + 1);
+
+    if(sw == NULL) {
+        return NULL;
+    }
+    sw->s_max = s_max;
+    sw->e_max = e_max;
+    sw->b = b;
+    sw->rng = 0x9E3779B97F4A7C15ULL;
+    sw->nodes = calloc(s_max + 1, sizeof(node_t *));
+    sw->root = calloc(s_max + 1, sizeof(int *));
+    sw->reuse = calloc(buckets, sizeof(unsigned long long));
+    sw->cold = calloc(buckets, sizeof(unsigned long long));
+    if(sw->nodes == NULL || sw->root == NULL || sw->reuse == NULL || sw->cold == NULL) {
+        sweep_free(sw);
+        return NULL;
+    }
+    for(int s = 0; s <= s_max; s++) {
+        if((sw->root[s] = calloc((size_t)1 << s, sizeof(int))) == NULL) {
+            sweep_free(sw);
+            return NULL;
+        }
+    }
+    return sw;
+}
+
+void sweep_free(sweep_t *sw) {
+    for(int s = 0; s <= sw->s_max; s++) {
+        if(sw->nodes != NULL) {
+            free(sw->nodes[s]);
+        }
+        if(sw->root != NULL) {
+            free(sw->root[s]);
+        }
+    }
+    free(sw->nodes);
+    free(sw->root);
+    free(sw->slot_block);
+    free(sw->slot_id);
+    free(sw->prio);
+    free(sw->reuse);
+    free(sw->cold);
+    free(sw);
+}
+
+static inline size_t hash_block(unsigned long long block, size_t slots) {
+    return (block * 0x9E3779B97F4A7C15ULL) >> 17 & (slots - 1);
+}
+
+// grow_slots - Double the block table. Returns -1 if out of memory.
+static int grow_slots(sweep_t *sw) {
+    size_t slots = sw->slots ? sw->slots * 2 : 1024;
+    unsigned long long *blocks = malloc(slots * sizeof(unsigned long long));
+    int *ids = calloc(slots, sizeof(int));
+
+    if(blocks == NULL || ids == NULL) {
+        free(blocks);
+        free(ids);
+        return -1;
+    }
+    for(size_t i = 0; i < sw->slots; i++) {
+        if(sw->slot_id[i] != 0) {
+            size_t j = hash_block(sw->slot_block[i], slots);
+            while(ids[j] != 0) {
+                j = (j + 1) & (slots - 1);
+            }
+            blocks[j] = sw->slot_block[i];
+            ids[j] = sw->slot_id[i];
+        }
+    }
+    free(sw->slot_block);
+    free(sw->slot_id);
+    sw->slot_block = blocks;
+    sw->slot_id = ids;
+    sw->slots = slots;
+    return 0;
+}
+
+// grow_nodes - Make room for more block ids in every level
+static int grow_nodes(sweep_t *sw) {
+    int capacity = sw->capacity ? sw->capacity * 2 : 1024;
+    unsigned int *prio = realloc(sw->prio, capacity * sizeof(unsigned int));
+
+    if(prio == NULL) {
+        return -1;
+    }
+    sw->prio = prio;
+    for(int s = 0; s <= sw->s_max; s++) {
+        node_t *n = realloc(sw->nodes[s], capacity * sizeof(node_t));
+        if(n == NULL) {
+            return -1;
+        }
+        if(sw->capacity == 0) {
+            memset(&n[0], 0, sizeof(node_t));
+        }
+        sw->nodes[s] = n;
+    }
+    sw->capacity = capacity;
+    return 0;
+}
+
+int sweep_access(sweep_t *sw, unsigned long long address) {
+    unsigned long long block = address >> sw->b;
+    int stride = sw->e_max + 1;
+
+    if((size_t)(sw->nblocks + 1) * 2 > sw->slots && grow_slots(sw) < 0) {
+        return -1;
+    }
+
+    size_t i = hash_block(block, sw->slots);
+    while(sw->slot_id[i] != 0 && sw->slot_block[i] != block) {
+        i = (i + 1) & (sw->slots - 1);
+    }
+
+    sw->clock++;
+    int id = sw->slot_id[i];
+    if(id == 0) {
+        // First touch: a cold miss at every level
+        if(sw->nblocks + 1 >= sw->capacity && grow_nodes(sw) < 0) {
+            return -1;
+        }
+        id = ++sw->nblocks;
+        sw->slot_block[i] = block;
+        sw->slot_id[i] = id;
+        sw->rng ^= sw->rng << 13;
+        sw->rng ^= sw->rng >> 7;
+        sw->rng ^= sw->rng << 17;
+        sw->prio[id] = sw->rng;
+
+        for(int s = 0; s <= sw->s_max; s++) {
+            node_t *n = sw->nodes[s];
+            int *root = &sw->root[s][block & ((1ULL << s) - 1)];
+            int held = size_of(n, *root);
+
+            sw->cold[s * stride + held]++;
+            insert_newest(sw, n, root, id);
+        }
+        return 0;
+    }
+
+    for(int s = 0; s <= sw->s_max; s++) {
+        node_t *n = sw->nodes[s];
+        int *root = &sw->root[s][block & ((1ULL << s) - 1)];
+        unsigned long long key = n[id].key;
+        int older, self, newer;
+
+        if(key == 0) {
+            // Fell out of the treap: at least e_max blocks since
+            sw->reuse[s * stride + sw->e_max]++;
+            insert_newest(sw, n, root, id);
+            continue;
+        }
+
+        split(n, *root, key, &older, &self);
+        split(n, self, key + 1, &self, &newer);
+        sw->reuse[s * stride + size_of(n, newer)]++;
+        *root = merge(n, sw->prio, older, newer);
+        insert_newest(sw, n, root, id);
+    }
+    return 0;
+}
+
+void sweep_counts(const sweep_t *sw, int s, int E, unsigned long long *hits,
+                  unsigned long long *misses, unsigned long long *evictions) {
+    const unsigned long long *reuse = sw->reuse + s * (sw->e_max + 1);
+    const unsigned long long *cold = sw->cold + s * (sw->e_max + 1);
+
+    *hits = *misses = *evictions = 0;
+    for(int d = 0; d <= sw->e_max; d++) {
+        if(d < E) {
+            *hits += reuse[d];
+        }
+        else {
+            *misses += reuse[d];
+            *evictions += reuse[d] + cold[d];
+        }
+        *misses += cold[d];
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * csim-sweep.h - One-pass LRU simulation of many cache geometries
+ *
+ * For a fixed block size, every access gets its LRU stack distance in
+ * each set of each candidate set count (Mattson et al.). A cache of E
+ * ways hits exactly when that distance is below E, so histograms of the
+ * distances give hit/miss/eviction counts for every (s, E) at once.
+ */
+
+#ifndef CSIM_SWEEP_H
+#define CSIM_SWEEP_H
+
+typedef struct sweep sweep_t;
+
+/*
+ * sweep_create - Track s = 0..s_max set index bits and E = 1..e_max
+ *     ways for b block offset bits. Returns NULL if out of memory.
+ */
+sweep_t *sweep_create(int s_max, int e_max, int b);
+
+/* sweep_access - Feed one access. Returns -1 if out of memory. */
+int sweep_access(sweep_t *sw, unsigned long long address);
+
+/* sweep_counts - What an (s, E) LRU cache would have counted so far */
+void sweep_counts(const sweep_t *sw, int s, int E, unsigned long long *hits,
+                  unsigned long long *misses, unsigned long long *evictions);
+
+void sweep_free(sweep_t *sw);
+
+#endif /* CSIM_SWEEP_H */
@@ -0,0 +1,725 @@
+/*
+ * csim-trace.c - Fast reader for valgrind lackey memory traces
+ *
+ * Lines look like "I  0400d7d4,8" or " M 0421c7f0,4". Regular files are
+ * mmapped whole; pipes and terminals are read TRACE_BLOCK bytes at a
+ * time. Either way the parser only ever looks at complete lines, so it
+ * can run to the next '\n' without bounds checks.
+ *
+ * The same reader also replays the binary format written by
+ * trace_writer_open(). After the 8-byte TRACE_MAGIC the file is a run of
+ * independent blocks, each a 12-byte little-endian header
+ *
+ *     nrecs, raw_len, stored_len
+ *
+ * followed by stored_len bytes of payload, zlib-compressed when
+ * stored_len != raw_len. The top bit of nrecs is set when none of the
+ * block's records is an instruction fetch, which lets trace_skip() pass
+ * over the whole block by its header. The raw payload packs each record as
+ *
+ *     op/size byte    bits 0-1 op (I, L, S, M), bits 2-7 size, where
+ *                     63 means a varint with the real size follows
+ *     address delta   zigzagged difference from the previous address
+ *                     in the block, as a LEB128 varint
+ *
+ * so a typical record costs 2-3 bytes instead of ~20.
+ *
+ * Pipes and FIFOs (e.g. valgrind writing to a mkfifo) are read by a
+ * helper thread into two TRACE_BLOCK slots, so the next block arrives
+ * while the current one is being parsed and simulated. The reader never
+ * holds more than the two slots and its own block buffer, however long
+ * the trace runs.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "csim-trace.h"
+
+#define TRACE_BLOCK (1 << 20)
+
+/* Raw payload per binary block; compressBound() of it fits a TRACE_BLOCK */
+#define TRACE_BIN_BLOCK (256 << 10)
+#define TRACE_BIN_HEADER 12
+#define TRACE_SIZE_ESCAPE 63
+#define TRACE_BIN_DATA_ONLY 0x80000000u /* nrecs flag: the block has no 'I' records */
+
+static const char trace_ops[4] = { 'I', 'L', 'S', 'M' };
+
+/* Double buffer filled by the helper thread for non-mmapped input */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *slot[2];
+    size_t len[2];
+    int full[2];                /* slot holds data not yet taken */
+    int started;
+    int done;                   /* the thread hit EOF or an error */
+    int stop;                   /* trace_close() wants the thread gone */
+    int take;                   /* slot the parser reads next */
+    size_t off;                 /* bytes of it already taken */
+} readahead_t;
+
+struct trace_reader {
+    int fd;
+    int flags;
+    readahead_t *ahead;      /* NULL when mmapped */
+
+    const char *map;            /* the whole file when mmapped */
+    size_t map_len;
+    char *buf;                  /* block buffer otherwise */
+    size_t buf_len;
+    int eof;
+
+    const char *cur;            /* next byte to parse */
+    const char *lim;            /* end of the complete lines in view */
+    char tail[128];             /* unterminated last line of a mapped file */
+    int tail_used;
+
+    int binary;                 /* input started with TRACE_MAGIC */
+    int bad;                    /* truncated or corrupt binary input */
+    unsigned char *zbuf;        /* inflated payload of the current block */
+    const unsigned char *bcur;  /* next record in the current block */
+    const unsigned char *bend;
+    unsigned long long prev;    /* last address, deltas are relative to it */
+};
+
+struct trace_writer {
+    FILE *fp;
+    int flags;
+    unsigned char *raw;         /* payload of the block being built */
+    size_t raw_len;
+    unsigned int nrecs;
+    int instr;                  /* the block holds 'I' records */
+    unsigned char *zbuf;
+    unsigned long long prev;
+};
+
+/* Hex digit value + 1, 0 for anything that is not a hex digit */
+static const unsigned char hexval[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/* last_newline - One past the last '\n' in [p, end), or p if there is none */
+static const char *last_newline(const char *p, const char *end) {
+    while(end > p && end[-1] != '\n') {
+        end--;
+    }
+    return end;
+}
+
+/* read_ahead - Helper thread: fill the free slot, hand it over, repeat */
+static void *read_ahead(void *arg) {
+    trace_reader_t *tr = arg;
+    readahead_t *a = tr->ahead;
+    int idx = 0, eof = 0;
+
+    /* Only read() may be cancelled, never a wait holding the lock */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while(!eof) {
+        pthread_mutex_lock(&a->lock);
+        while(a->full[idx] && !a->stop) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        int stop = a->stop;
+        pthread_mutex_unlock(&a->lock);
+        if(stop) {
+            break;
+        }
+
+        size_t len = 0;
+        while(len < TRACE_BLOCK) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            ssize_t n = read(tr->fd, a->slot[idx] + len, TRACE_BLOCK - len);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                eof = 1;
+                break;
+            }
+            len += n;
+        }
+
+        pthread_mutex_lock(&a->lock);
+        a->len[idx] = len;
+        a->full[idx] = 1;
+        a->done = eof;
+        pthread_cond_broadcast(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+        idx ^= 1;
+    }
+    return NULL;
+}
+
+/* pull - Copy up to len bytes from the helper's slots, 0 at EOF */
+static size_t pull(trace_reader_t *tr, char *dst, size_t len) {
+    readahead_t *a = tr->ahead;
+    int t = a->take;
+
+    pthread_mutex_lock(&a->lock);
+    while(!a->full[t] && !a->done) {
+        pthread_cond_wait(&a->cond, &a->lock);
+    }
+    int full = a->full[t];
+    pthread_mutex_unlock(&a->lock);
+    if(!full) {
+        return 0;
+    }
+
+    size_t n = a->len[t] - a->off;
+    if(n > len) {
+        n = len;
+    }
+    memcpy(dst, a->slot[t] + a->off, n);
+    a->off += n;
+    if(a->off == a->len[t]) {
+        pthread_mutex_lock(&a->lock);
+        a->full[t] = 0;
+        pthread_cond_broadcast(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+        a->take ^= 1;
+        a->off = 0;
+    }
+    return n;
+}
+
+/* fill - Top up the block buffer, keeping the unread bytes from cur on */
+static void fill(trace_reader_t *tr) {
+    size_t left = tr->buf + tr->buf_len - tr->cur;
+    memmove(tr->buf, tr->cur, left);
+    tr->buf_len = left;
+    tr->cur = tr->buf;
+    while(!tr->eof && tr->buf_len < TRACE_BLOCK) {
+        size_t n = pull(tr, tr->buf + tr->buf_len, TRACE_BLOCK - tr->buf_len);
+        if(n == 0) {
+            tr->eof = 1;
+            break;
+        }
+        tr->buf_len += n;
+    }
+}
+
+/* start_ahead - Set up the slots and start the helper thread */
+static int start_ahead(trace_reader_t *tr) {
+    readahead_t *a = calloc(1, sizeof(readahead_t));
+
+    if(a == NULL) {
+        return -1;
+    }
+    a->slot[0] = malloc(TRACE_BLOCK);
+    a->slot[1] = malloc(TRACE_BLOCK);
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+    tr->ahead = a;
+    if(a->slot[0] == NULL || a->slot[1] == NULL ||
+       pthread_create(&a->thread, NULL, read_ahead, tr) != 0) {
+        return -1;
+    }
+    a->started = 1;
+    return 0;
+}
+
+/* stop_ahead - Stop the helper thread, even if it is blocked in read() */
+static void stop_ahead(readahead_t *a) {
+    pthread_mutex_lock(&a->lock);
+    int running = !a->done;
+    a->stop = 1;
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+    if(a->started) {
+        if(running) {
+            pthread_cancel(a->thread);
+        }
+        pthread_join(a->thread, NULL);
+    }
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->cond);
+    free(a->slot[0]);
+    free(a->slot[1]);
+    free(a);
+}
+
+/*
+ * refill - Bring the next complete lines into view. Returns 0 once the
+ *     trace is exhausted.
+ */
+static int refill(trace_reader_t *tr) {
+    if(tr->map != NULL) {
+        /* A mapped file has one view, plus possibly its last line */
+        if(tr->tail_used || tr->tail[0] == '\0') {
+            return 0;
+        }
+        tr->tail_used = 1;
+        tr->cur = tr->tail;
+        tr->lim = tr->tail + strlen(tr->tail);
+        return 1;
+    }
+
+    fill(tr);
+    if(tr->eof && tr->buf_len > 0 && tr->buf[tr->buf_len - 1] != '\n') {
+        tr->buf[tr->buf_len++] = '\n';
+    }
+
+    tr->lim = last_newline(tr->buf, tr->buf + tr->buf_len);
+    return tr->lim > tr->cur;
+}
+
+/* peek - Bring n contiguous raw bytes into view, or return NULL if there are fewer */
+static const unsigned char *peek(trace_reader_t *tr, size_t n) {
+    if(tr->map == NULL && (size_t)(tr->buf + tr->buf_len - tr->cur) < n) {
+        fill(tr);
+    }
+
+    const char *end = tr->map != NULL ? tr->map + tr->map_len : tr->buf + tr->buf_len;
+    if((size_t)(end - tr->cur) < n) {
+        return NULL;
+    }
+    return (const unsigned char *)tr->cur;
+}
+
+/* take - Consume n contiguous raw bytes, or return NULL if there are fewer */
+static const unsigned char *take(trace_reader_t *tr, size_t n) {
+    const unsigned char *p = peek(tr, n);
+    if(p != NULL) {
+        tr->cur += n;
+    }
+    return p;
+}
+
+static unsigned int get32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+static void put32(unsigned char *p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * next_block - Bring the next binary block into view. Returns 0 at the
+ *     end of the trace, setting tr->bad if it ended mid-block.
+ */
+static int next_block(trace_reader_t *tr) {
+    const unsigned char *h = take(tr, TRACE_BIN_HEADER);
+    if(h == NULL) {
+        const char *end = tr->map != NULL ? tr->map + tr->map_len : tr->buf + tr->buf_len;
+        tr->bad |= tr->cur != end;
+        return 0;
+    }
+
+    unsigned int raw_len = get32(h + 4);
+    /* nrecs and its TRACE_BIN_DATA_ONLY flag only matter to trace_skip() */
+    unsigned int stored_len = get32(h + 8);
+    const unsigned char *p;
+    if(raw_len > TRACE_BIN_BLOCK || stored_len > compressBound(TRACE_BIN_BLOCK) ||
+       (p = take(tr, stored_len)) == NULL) {
+        tr->bad = 1;
+        return 0;
+    }
+
+    if(stored_len == raw_len) {
+        /* Stored as is; the bytes stay put until the next take() */
+        tr->bcur = p;
+    }
+    else {
+        uLongf len = TRACE_BIN_BLOCK;
+        if(uncompress(tr->zbuf, &len, p, stored_len) != Z_OK || len != raw_len) {
+            tr->bad = 1;
+            return 0;
+        }
+        tr->bcur = tr->zbuf;
+    }
+    tr->bend = tr->bcur + raw_len;
+    tr->prev = 0;
+    return 1;
+}
+
+/* get_varint - Decode a LEB128 varint, or return 0 with *ok cleared if it overruns end */
+static inline unsigned long long get_varint(const unsigned char **pp, const unsigned char *end, int *ok) {
+    const unsigned char *p = *pp;
+    unsigned long long v = 0;
+    int shift = 0;
+
+    while(p < end && shift < 64) {
+        unsigned char c = *p++;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if(!(c & 0x80)) {
+            *pp = p;
+            return v;
+        }
+        shift += 7;
+    }
+    *ok = 0;
+    return 0;
+}
+
+/* read_binary - trace_read() for the binary format */
+static size_t read_binary(trace_reader_t *tr, trace_rec_t *recs, size_t max) {
+    size_t n = 0;
+    int keep_instr = tr->flags & TRACE_KEEP_INSTR;
+
+    while(n < max) {
+        if(tr->bcur >= tr->bend && !next_block(tr)) {
+            break;
+        }
+
+        const unsigned char *p = tr->bcur;
+        int ok = 1;
+        unsigned char hdr = *p++;
+        unsigned int size = hdr >> 2;
+        if(size == TRACE_SIZE_ESCAPE) {
+            size = get_varint(&p, tr->bend, &ok);
+        }
+        unsigned long long zz = get_varint(&p, tr->bend, &ok);
+        if(!ok) {
+            tr->bad = 1;
+            tr->bcur = tr->bend;
+            break;
+        }
+        tr->bcur = p;
+        tr->prev += (zz >> 1) ^ -(zz & 1);
+
+        char op = trace_ops[hdr & 3];
+        if(op == 'I' && !keep_instr) {
+            continue;
+        }
+        recs[n].addr = tr->prev;
+        recs[n].size = size;
+        recs[n].op = op;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * skip_binary - trace_skip() for the binary format. A block that lies
+ *     wholly inside the skip, and whose header says how many of its
+ *     records trace_read() would return, is passed over without being
+ *     inflated or decoded.
+ */
+static size_t skip_binary(trace_reader_t *tr, size_t max) {
+    trace_rec_t recs[256];
+    size_t n = 0;
+
+    while(n < max) {
+        if(tr->bcur >= tr->bend) {
+            const unsigned char *h = peek(tr, TRACE_BIN_HEADER);
+            if(h != NULL) {
+                unsigned int nrecs = get32(h), stored_len = get32(h + 8);
+                int counted = (nrecs & TRACE_BIN_DATA_ONLY) || (tr->flags & TRACE_KEEP_INSTR);
+                nrecs &= ~TRACE_BIN_DATA_ONLY;
+                if(counted && nrecs <= max - n && stored_len <= compressBound(TRACE_BIN_BLOCK) &&
+                   take(tr, TRACE_BIN_HEADER + stored_len) != NULL) {
+                    n += nrecs;
+                    continue;
+                }
+            }
+        }
+        /*
+         * One record at a time inside a block, so the skip stops at its
+         * end rather than running into the next one, which may be passed
+         * over whole; in chunks through blocks that cannot be
+         */
+        size_t want = tr->bcur < tr->bend ? 1 : max - n < 256 ? max - n : 256;
+        size_t got = read_binary(tr, recs, want);
+        if(got == 0) {
+            break;
+        }
+        n += got;
+    }
+    return n;
+}
+
+trace_reader_t *trace_open(const char *path, int flags) {
+    trace_reader_t *tr = calloc(1, sizeof(trace_reader_t));
+    struct stat st;
+
+    if(tr == NULL) {
+        return NULL;
+    }
+    tr->flags = flags;
+    tr->fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+    if(tr->fd < 0) {
+        free(tr);
+        return NULL;
+    }
+
+    if(fstat(tr->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, tr->fd, 0);
+        if(map != MAP_FAILED) {
+            posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+            tr->map = map;
+            tr->map_len = st.st_size;
+            tr->cur = tr->map;
+            if(tr->map_len >= TRACE_MAGIC_LEN && memcmp(tr->map, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+                tr->binary = 1;
+                tr->cur += TRACE_MAGIC_LEN;
+                if((tr->zbuf = malloc(TRACE_BIN_BLOCK)) == NULL) {
+                    trace_close(tr);
+                    return NULL;
+                }
+                return tr;
+            }
+            tr->lim = last_newline(tr->map, tr->map + tr->map_len);
+
+            size_t tail_len = tr->map + tr->map_len - tr->lim;
+            if(tail_len > 0 && tail_len < sizeof(tr->tail) - 1) {
+                memcpy(tr->tail, tr->lim, tail_len);
+                tr->tail[tail_len] = '\n';
+            }
+            return tr;
+        }
+    }
+
+    /* One spare byte for the newline refill() may add at EOF */
+    tr->buf = malloc(TRACE_BLOCK + 1);
+    if(tr->buf == NULL || start_ahead(tr) < 0) {
+        trace_close(tr);
+        return NULL;
+    }
+    tr->cur = tr->lim = tr->buf;
+
+    /* Sniff the format from the first block; refill() keeps what was read */
+    fill(tr);
+    if(tr->buf_len >= TRACE_MAGIC_LEN && memcmp(tr->buf, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+        tr->binary = 1;
+        tr->cur += TRACE_MAGIC_LEN;
+        if((tr->zbuf = malloc(TRACE_BIN_BLOCK)) == NULL) {
+            trace_close(tr);
+            return NULL;
+        }
+    }
+    return tr;
+}
+
+size_t trace_read(trace_reader_t *tr, trace_rec_t *recs, size_t max) {
+    size_t n = 0;
+    int keep_instr = tr->flags & TRACE_KEEP_INSTR;
+
+    if(tr->binary) {
+        return read_binary(tr, recs, max);
+    }
+
+    while(n < max) {
+        if(tr->cur >= tr->lim && !refill(tr)) {
+            break;
+        }
+
+        const char *p = tr->cur;
+        while(*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        char op = *p;
+        if((op != 'L' && op != 'S' && op != 'M' && op != 'I') || (op == 'I' && !keep_instr)) {
+            /* Instruction fetches and valgrind chatter are skipped whole */
+            tr->cur = (const char *)memchr(p, '\n', tr->lim - p) + 1;
+            continue;
+        }
+
+        p++;
+        while(*p == ' ') {
+            p++;
+        }
+
+        unsigned long long addr = 0;
+        unsigned int v;
+        while((v = hexval[(unsigned char)*p]) != 0) {
+            addr = (addr << 4) | (v - 1);
+            p++;
+        }
+
+        unsigned int size = 0;
+        if(*p == ',') {
+            p++;
+            while((unsigned)(*p - '0') < 10) {
+                size = size * 10 + (*p - '0');
+                p++;
+            }
+        }
+
+        while(*p != '\n') {
+            p++;
+        }
+        tr->cur = p + 1;
+
+        recs[n].addr = addr;
+        recs[n].size = size;
+        recs[n].op = op;
+        n++;
+    }
+    return n;
+}
+
+size_t trace_skip(trace_reader_t *tr, size_t max) {
+    size_t n = 0;
+    int keep_instr = tr->flags & TRACE_KEEP_INSTR;
+
+    if(tr->binary) {
+        return skip_binary(tr, max);
+    }
+
+    /* Only the op is looked at, the address is never parsed */
+    while(n < max) {
+        if(tr->cur >= tr->lim && !refill(tr)) {
+            break;
+        }
+
+        const char *p = tr->cur;
+        while(*p == ' ' || *p == '\t') {
+            p++;
+        }
+        char op = *p;
+        n += op == 'L' || op == 'S' || op == 'M' || (op == 'I' && keep_instr);
+        tr->cur = (const char *)memchr(p, '\n', tr->lim - p) + 1;
+    }
+    return n;
+}
+
+void trace_close(trace_reader_t *tr) {
+    if(tr->ahead != NULL) {
+        stop_ahead(tr->ahead);
+    }
+    if(tr->map != NULL) {
+        munmap((void *)tr->map, tr->map_len);
+    }
+    free(tr->buf);
+    free(tr->zbuf);
+    if(tr->fd > STDIN_FILENO) {
+        close(tr->fd);
+    }
+    free(tr);
+}
+
+int trace_error(const trace_reader_t *tr) {
+    return tr->bad;
+}
+
+trace_writer_t *trace_writer_open(const char *path, int flags) {
+    trace_writer_t *tw = calloc(1, sizeof(trace_writer_t));
+
+    if(tw == NULL) {
+        return NULL;
+    }
+    tw->flags = flags;
+    tw->raw = malloc(TRACE_BIN_BLOCK);
+    tw->zbuf = malloc(compressBound(TRACE_BIN_BLOCK));
+    tw->fp = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+    if(tw->raw == NULL || tw->zbuf == NULL || tw->fp == NULL ||
+       fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, tw->fp) != TRACE_MAGIC_LEN) {
+        if(tw->fp != NULL && tw->fp != stdout) {
+            fclose(tw->fp);
+        }
+        free(tw->raw);
+        free(tw->zbuf);
+        free(tw);
+        return NULL;
+    }
+    return tw;
+}
+
+/* flush_block - Write out the block being built. Returns -1 on error. */
+static int flush_block(trace_writer_t *tw) {
+    unsigned char h[TRACE_BIN_HEADER];
+    const unsigned char *payload = tw->raw;
+    uLongf stored_len = tw->raw_len;
+
+    if(tw->nrecs == 0) {
+        return 0;
+    }
+    if(tw->flags & TRACE_COMPRESS) {
+        uLongf len = compressBound(TRACE_BIN_BLOCK);
+        /* Keep the block raw unless deflating it actually saves space */
+        if(compress2(tw->zbuf, &len, tw->raw, tw->raw_len, Z_DEFAULT_COMPRESSION) == Z_OK &&
+           len < tw->raw_len) {
+            payload = tw->zbuf;
+            stored_len = len;
+        }
+    }
+
+    put32(h, tw->nrecs | (tw->instr ? 0 : TRACE_BIN_DATA_ONLY));
+    put32(h + 4, tw->raw_len);
+    put32(h + 8, stored_len);
+    tw->raw_len = 0;
+    tw->nrecs = 0;
+    tw->instr = 0;
+    tw->prev = 0;
+    if(fwrite(h, 1, sizeof(h), tw->fp) != sizeof(h) ||
+       fwrite(payload, 1, stored_len, tw->fp) != stored_len) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline unsigned char *put_varint(unsigned char *p, unsigned long long v) {
+    while(v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+int trace_write(trace_writer_t *tw, const trace_rec_t *recs, size_t n) {
+    /* Header byte, 5-byte size varint and 10-byte delta varint at most */
+    const size_t max_rec = 16;
+
+    for(size_t i = 0; i < n; i++) {
+        if(tw->raw_len + max_rec > TRACE_BIN_BLOCK && flush_block(tw) < 0) {
+            return -1;
+        }
+
+        int op;
+        switch (recs[i].op) {
+            case 'L': op = 1; break;
+            case 'S': op = 2; break;
+            case 'M': op = 3; break;
+            default: op = 0; tw->instr = 1; break;
+        }
+
+        unsigned char *p = tw->raw + tw->raw_len;
+        unsigned long long delta = recs[i].addr - tw->prev;
+        if(recs[i].size < TRACE_SIZE_ESCAPE) {
+            *p++ = op | recs[i].size << 2;
+        }
+        else {
+            *p++ = op | TRACE_SIZE_ESCAPE << 2;
+            p = put_varint(p, recs[i].size);
+        }
+        p = put_varint(p, (delta << 1) ^ -(delta >> 63));
+        tw->raw_len = p - tw->raw;
+        tw->prev = recs[i].addr;
+        tw->nrecs++;
+    }
+    return 0;
+}
+
+int trace_writer_close(trace_writer_t *tw) {
+    int rc = flush_block(tw);
+
+    if(tw->fp == stdout) {
+        rc |= fflush(tw->fp);
+    }
+    else {
+        rc |= fclose(tw->fp);
+    }
+    free(tw->raw);
+    free(tw->zbuf);
+    free(tw);
+    return rc ? -1 : 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * csim-trace.h - Fast reader for valgrind lackey memory traces, and
+ *     reader/writer for the compact binary trace format
+ */
+
+#ifndef CSIM_TRACE_H
+#define CSIM_TRACE_H
+
+#include <stddef.h>
+
+/* One decoded trace record */
+typedef struct {
+    unsigned long long addr;
+    unsigned int size;
+    char op;                    /* 'I', 'L', 'S' or 'M' */
+} trace_rec_t;
+
+/* trace_open() flags */
+#define TRACE_KEEP_INSTR 1      /* return 'I' records instead of skipping them */
+
+/* trace_writer_open() flags */
+#define TRACE_COMPRESS 1        /* zlib-compress blocks where it pays */
+
+/* First bytes of a binary trace */
+#define TRACE_MAGIC "CSIMTRC1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct trace_reader trace_reader_t;
+typedef struct trace_writer trace_writer_t;
+
+/*
+ * trace_open - Open a trace file for reading, or stdin if path is "-".
+ *     Text and binary traces are told apart by TRACE_MAGIC. Regular
+ *     files are mmapped, anything else is read in large blocks.
+ *     Returns NULL (with errno set) on failure.
+ */
+trace_reader_t *trace_open(const char *path, int flags);
+
+/*
+ * trace_read - Decode up to max records into recs. Returns the number
+ *     decoded, 0 at end of trace.
+ */
+size_t trace_read(trace_reader_t *tr, trace_rec_t *recs, size_t max);
+
+/*
+ * trace_skip - Pass over up to max of the records trace_read() would
+ *     return, without decoding them where the format allows. Returns
+ *     the number passed over, less than max only at end of trace.
+ */
+size_t trace_skip(trace_reader_t *tr, size_t max);
+
+void trace_close(trace_reader_t *tr);
+
+/* trace_error - Nonzero if a binary trace turned out truncated or corrupt */
+int trace_error(const trace_reader_t *tr);
+
+/*
+ * trace_writer_open - Start a binary trace at path, or on stdout if path
+ *     is "-". Returns NULL on failure.
+ */
+trace_writer_t *trace_writer_open(const char *path, int flags);
+
+/* trace_write - Append n records. Returns -1 on a write error. */
+int trace_write(trace_writer_t *tw, const trace_rec_t *recs, size_t n);
+
+/* trace_writer_close - Flush and close. Returns -1 on a write error. */
+int trace_writer_close(trace_writer_t *tw);
+
+#endif /* CSIM_TRACE_H */
@@ -3,19 +3,24 @@
 #include "stdlib.h"
 #include "string.h"
 #include <assert.h>
+#include <errno.h>
 #include <bits/getopt_core.h>
+#include "csim-cache.h"
+#include "csim-lib.h"
+#include "csim-hier.h"
+#include "csim-prefetch.h"
+#include "csim-par.h"
+#include "csim-attr.h"
+#include "csim-3c.h"
+#include "csim-sample.h"
+#include "csim-trace.h"
+#include "csim-sweep.h"
 
 // #define DEBUG 1
 #define MAX_ARRAY_NAME 200
+#define TRACE_BATCH 4096
 
-typedef struct {
-    int valid;
-    int tag;
-    int block_byte;
-    int time_stamp; // LRU Stamp
-} cache_line, *E_cache, **S_cache;
-
-S_cache _simulation_cache;
+csim_t *simulation;
 
 char tracefile_path[MAX_ARRAY_NAME];
 int S, E, b;
@@ -23,143 +28,449 @@ int h, v, s;
 int hit_count     = 0;
 int miss_count    = 0;
 int replace_count = 0;
+int sweep_mode = 0;
+int verify_sweep = 0;
+hier_t *hierarchy = NULL;
+int hier_policy = HIER_NINE;
+int mem_latency = 100;
+int replacement = CACHE_LRU;
+prefetcher_t *prefetcher = NULL;
+int nthreads = 1;
+int split_accesses = 0;
+attr_t *attribution = NULL;
+int attr_top = 20;
+classify_t *classifier = NULL;
+int classify_misses = 0;
+sample_cfg_t sampling;
 
 void PrintHelpInfo() {
-    puts("Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file>");
+    puts("Usage: ./csim-ref [-hvwc] -s <num> -E <num> -b <num> -t <file>");
     puts("Options:");
     puts("  -h         Print this help message.");
     puts("  -v         Optional verbose flag.");
     puts("  -s <num>   Number of set index bits.");
     puts("  -E <num>   Number of lines per set.");
     puts("  -b <num>   Number of block offset bits.");
-    puts("  -t <file>  Trace file.");
+    puts("  -t <file>  Trace file, FIFO, or '-' to stream stdin.");
+    puts("  -w         Sweep every s in 0..-s and E in 1..-E in one pass.");
+    puts("  -c         With -w, check each result against a direct run;");
+    puts("             with -S/-T, check the estimate against a full run.");
+    puts("  -L <spec>  Add a hierarchy level name:s:E:b:latency, top first;");
+    puts("             L1I sees instruction fetches. Replaces -s/-E/-b.");
+    puts("  -P <name>  Hierarchy policy: nine (default), inclusive, exclusive.");
+    puts("  -m <num>   Memory latency in cycles for -L (default 100).");
+    puts("  -R <name>  Replacement: lru (default), fifo, random, plru, bitplru,");
+    puts("             srrip, brrip, or opt (Belady, single level only).");
+    puts("  -F <spec>  Prefetcher next, stride or stream[:degree[:distance]].");
+    puts("  -j <num>   Simulate with this many threads, each owning a slice of the sets.");
+    puts("  -B         Split accesses that straddle blocks into one access per block.");
+    puts("  -A <num>   Attribute misses to instructions, list the top <num>.");
+    puts("  -r <spec>  Also attribute to the region name:start:end (hex), e.g. A:6020c0:6060c0.");
+    puts("  -C         Classify misses as compulsory, capacity or conflict.");
+    puts("  -S <num>   Estimate from about 1 set in <num>, with 95% intervals.");
+    puts("             The busiest sets always run exactly, so a trace that");
+    puts("             stays in a few sets gains little; try -T there.");
+    puts("  -T <spec>  Estimate from windows period:warmup:window (in accesses).");
+    puts("             Once the cache is full, the rest of each period is skipped");
+    puts("             undecoded, fastest on a binary trace.");
     puts("Examples:");
     puts("  linux>  ./csim-ref -s 4 -E 1 -b 4 -t traces/yi.trace");
     puts("  linux>  ./csim-ref -v -s 8 -E 2 -b 4 -t traces/yi.trace");
+    puts("  linux>  ./csim-ref -w -s 8 -E 16 -b 5 -t traces/long.trace");
+    puts("  linux>  ./csim-ref -L L1D:6:8:6:4 -L L2:10:8:6:12 -P inclusive -t traces/long.trace");
+    puts("  linux>  ./csim-ref -R opt -s 4 -E 4 -b 4 -t traces/long.trace");
+    puts("  linux>  ./csim-ref -F stride:2:4 -s 5 -E 2 -b 5 -t traces/trans.trace");
+    puts("  linux>  ./csim-ref -T 10000:1000:1000 -s 5 -E 1 -b 5 -t traces/long.trace");
 }
 
 void InitCache() {
-    _simulation_cache = (S_cache)malloc(sizeof(E_cache) * S);
-    for(int i = 0; i < S; i++) {
-        _simulation_cache[i] = (E_cache)malloc(sizeof(cache_line) * E);
-        for(int j = 0; j < E; j++) {
-            _simulation_cache[i][j].valid = 0;
-            _simulation_cache[i][j].tag = -1;
-            _simulation_cache[i][j].block_byte = -1;
-            _simulation_cache[i][j].time_stamp = -1;
-        }
+    csim_config_t cfg = { .s = s, .E = E, .b = b, .policy = replacement, .split = split_accesses };
+
+    if(replacement == CACHE_PLRU_TREE && (E & (E - 1)) != 0) {
+        fprintf(stderr, "%s replacement needs a power-of-two E\n", cache_policy_name(replacement));
+        exit(1);
+    }
+    if((simulation = csim_create(&cfg)) == NULL) {
+        fprintf(stderr, "Cannot allocate a cache of %d sets\n", S);
+        exit(1);
     }
 }
 
 void FreeCache() {
-    for(int i = 0; i < S; i++) {
-        free(_simulation_cache[i]);
-    }
-    free(_simulation_cache);
+    csim_free(simulation);
 }
 
-void UpdateTimeStamp() {
-    for(int i = 0; i < S; i++) {
-        for(int j = 0; j < E; j++) {
-            if(_simulation_cache[i][j].valid == 1) {
-                _simulation_cache[i][j].time_stamp++;
-            }
-        }
+// Per-access observers: the prefetcher and the miss classifier
+void Observe(void *arg, cache_t *c, unsigned long long address, int result, const cache_victim_t *victim) {
+    if(prefetcher != NULL) {
+        prefetch_access(prefetcher, c, address, result, victim);
+    }
+    if(classifier != NULL && classify_access(classifier, address, result != CACHE_MISS) < 0) {
+        fprintf(stderr, "Out of memory for -C\n");
+        exit(1);
     }
 }
 
-void Update(const unsigned int address) {
-    // Address: t bits | s bits | b bits
-    //          Tag      SetIndex BlockOffset
+int Update(const unsigned long long address) {
+    cache_t *c = csim_cache(simulation);
+    cache_victim_t victim;
+    int result = cache_access(c, address, 0, &victim);
 
-    // tag_offset = t bits
-    //              Tag
-    unsigned int tag_offset = address >> (s + b);
+    Observe(NULL, c, address, result, &victim);
+    if(result != CACHE_MISS) {
+        hit_count++;
+        return result;
+    }
+    miss_count++;
+    replace_count += victim.valid;
+    return result;
+}
 
-    // set_index = s bits => (t bits | s bits) & (000...0011...111) => s bits
-    //                                            t bits  s bits
-    unsigned int set_index = (address >> b) & ((-1U) >> (64 - s));
+// For each access, the index of the next access to the same block, or
+// ~0ULL if there is none. One reverse pass with a block -> index table.
+unsigned long long *NextUses(const unsigned long long *addrs, size_t n) {
+    size_t slots = 1024;
+    while(slots < 2 * n) {
+        slots *= 2;
+    }
+    unsigned long long *next = malloc(n * sizeof(unsigned long long));
+    unsigned long long *blocks = malloc(slots * sizeof(unsigned long long));
+    unsigned long long *seen = calloc(slots, sizeof(unsigned long long)); // index + 1, 0 = empty
+    if(next == NULL || blocks == NULL || seen == NULL) {
+        fprintf(stderr, "Cannot keep the trace for opt\n");
+        exit(1);
+    }
 
-    // hit cache
-    for(int i = 0; i < E; i++) {
-        if(_simulation_cache[set_index][i].valid == 1 && _simulation_cache[set_index][i].tag == tag_offset) {
-            hit_count++;
-            _simulation_cache[set_index][i].time_stamp = 0;
-            return ;
+    for(size_t i = n; i-- > 0; ) {
+        unsigned long long block = addrs[i] >> b;
+        size_t j = (block * 0x9E3779B97F4A7C15ULL) >> 17 & (slots - 1);
+        while(seen[j] != 0 && blocks[j] != block) {
+            j = (j + 1) & (slots - 1);
         }
+        next[i] = seen[j] ? seen[j] - 1 : ~0ULL;
+        blocks[j] = block;
+        seen[j] = i + 1;
     }
+    free(blocks);
+    free(seen);
+    return next;
+}
 
-    // miss cache
-    for(int i = 0; i < E; i++) {
-        if(_simulation_cache[set_index][i].valid == 0) {
-            miss_count++;
-            _simulation_cache[set_index][i].valid = 1;
-            _simulation_cache[set_index][i].tag = tag_offset;
-            _simulation_cache[set_index][i].time_stamp = 0;
-            return ;
+// OPT needs the future: load the whole trace, then replay it with each
+// access's next use in hand
+void OptCache(trace_reader_t *tr) {
+    trace_rec_t recs[TRACE_BATCH];
+    unsigned long long *addrs = NULL;
+    char *ops = NULL;
+    size_t n, kept = 0, room = 0;
+
+    while((n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        if(kept + n > room) {
+            room = room ? room * 2 : 1 << 16;
+            addrs = realloc(addrs, room * sizeof(unsigned long long));
+            ops = realloc(ops, room);
+            if(addrs == NULL || ops == NULL) {
+                fprintf(stderr, "Cannot keep the trace for opt\n");
+                exit(1);
+            }
+        }
+        for(size_t i = 0; i < n; i++) {
+            if(recs[i].op != 'I') {
+                addrs[kept] = recs[i].addr;
+                ops[kept] = recs[i].op;
+                kept++;
+            }
         }
     }
 
-    // replace cache
-    miss_count++;
-    replace_count++;
+    unsigned long long *next = NextUses(addrs, kept);
+    for(size_t i = 0; i < kept; i++) {
+        csim_cache(simulation)->next_use = next[i];
+        Update(addrs[i]);
+        if(ops[i] == 'M') {
+            hit_count++;
+        }
+    }
+    free(next);
+    free(addrs);
+    free(ops);
+}
 
-    int max_time_stamp = -9999;
-    int LRU_index = 0;
+// Decoded records go straight to the simulator, which flattens them into
+// block addresses (one per block touched with -B) and applies them in
+// batches so the cache can fetch the sets it is about to need
+void PipelineCache(trace_reader_t *tr) {
+    trace_rec_t recs[TRACE_BATCH];
+    csim_counts_t counts;
+    size_t n;
 
-    for(int i = 0; i < E; i++) {
-        if(_simulation_cache[set_index][i].time_stamp > max_time_stamp) {
-            max_time_stamp = _simulation_cache[set_index][i].time_stamp;
-            LRU_index = i;
-        }
+    while((n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        csim_access_batch(simulation, recs, n);
     }
 
-    _simulation_cache[set_index][LRU_index].valid = 1;
-    _simulation_cache[set_index][LRU_index].tag = tag_offset;
-    _simulation_cache[set_index][LRU_index].time_stamp = 0;
+    csim_counts(simulation, &counts);
+    hit_count = counts.hits;
+    miss_count = counts.misses;
+    replace_count = counts.evictions;
+}
+
+// Attribution: each data access is charged to the last I record's address
+void AttributeCache(trace_reader_t *tr) {
+    trace_rec_t recs[TRACE_BATCH];
+    unsigned long long pc = 0;
+    size_t n;
+
+    while((n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            unsigned long long addr = recs[i].addr;
+            if(recs[i].op == 'I') {
+                pc = addr;
+                continue;
+            }
 
+            int evictions = replace_count;
+            int hit = Update(addr) != CACHE_MISS;
+            int ok = attr_record(attribution, pc, addr, hit, replace_count - evictions) == 0;
+            if(recs[i].op == 'M') {
+                hit_count++;
+                ok &= attr_record(attribution, pc, addr, 1, 0) == 0;
+            }
+            if(!ok) {
+                fprintf(stderr, "Out of memory for attribution\n");
+                exit(1);
+            }
+        }
+    }
 }
 
 void ModifyCache() {
-    FILE *fp = fopen(tracefile_path, "r");
+    trace_reader_t *tr = trace_open(tracefile_path, attribution != NULL ? TRACE_KEEP_INSTR : 0);
 
-    char identifier;
-    unsigned int address;
-    int size;
+    if(tr == NULL) {
+        fprintf(stderr, "%s: %s\n", tracefile_path, strerror(errno));
+        exit(1);
+    }
 
     S = 1 << s;
     
     InitCache();
+    if(classify_misses && (classifier = classify_create(s, E, b)) == NULL) {
+        fprintf(stderr, "Out of memory for -C\n");
+        exit(1);
+    }
+    if(prefetcher != NULL || classifier != NULL) {
+        csim_set_hook(simulation, Observe, NULL);
+    }
+
+    if(replacement == CACHE_OPT) {
+        OptCache(tr);
+    }
+    else if(attribution != NULL) {
+        AttributeCache(tr);
+    }
+    else if(nthreads > 1) {
+        cache_t *c = csim_cache(simulation);
+        unsigned long long modifies;
+        if(par_simulate(c, tr, nthreads, &modifies) < 0) {
+            fprintf(stderr, "Cannot start %d simulation threads\n", nthreads);
+            exit(1);
+        }
+        hit_count = c->hits + modifies;
+        miss_count = c->misses;
+        replace_count = c->evictions;
+    }
+    else {
+        PipelineCache(tr);
+    }
+
+    if(trace_error(tr)) {
+        fprintf(stderr, "%s: truncated or corrupt binary trace\n", tracefile_path);
+        exit(1);
+    }
+    trace_close(tr);
+}
+
+// Direct LRU run of one geometry over records kept in memory
+void Simulate(int set_bits, int ways, const unsigned long long *addrs, const char *ops, size_t n) {
+    s = set_bits;
+    E = ways;
+    S = 1 << s;
+    hit_count = miss_count = replace_count = 0;
+    InitCache();
+    for(size_t i = 0; i < n; i++) {
+        Update(addrs[i]);
+        if(ops[i] == 'M') {
+            hit_count++;
+        }
+    }
+    FreeCache();
+}
 
-    while(fscanf(fp, " %c %x,%d", &identifier, &address, &size) > 0) {
-        switch (identifier) {
-            case 'I':
+// Sweep mode: -s and -E are the largest geometry, one pass covers all
+void SweepCache() {
+    int s_max = s, e_max = E;
+    sweep_t *sw = sweep_create(s_max, e_max, b);
+    trace_reader_t *tr = trace_open(tracefile_path, 0);
+    trace_rec_t recs[TRACE_BATCH];
+    unsigned long long modify_count = 0;
+    unsigned long long *addrs = NULL;
+    char *ops = NULL;
+    size_t n, kept = 0, room = 0;
+
+    if(tr == NULL) {
+        fprintf(stderr, "%s: %s\n", tracefile_path, strerror(errno));
+        exit(1);
+    }
+    if(sw == NULL) {
+        fprintf(stderr, "Cannot allocate the sweep\n");
+        exit(1);
+    }
+
+    while((n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        if(verify_sweep && kept + n > room) {
+            room = room ? room * 2 : 1 << 16;
+            addrs = realloc(addrs, room * sizeof(unsigned long long));
+            ops = realloc(ops, room);
+            if(addrs == NULL || ops == NULL) {
+                fprintf(stderr, "Cannot keep the trace for -c\n");
+                exit(1);
+            }
+        }
+        for(size_t i = 0; i < n; i++) {
+            if(recs[i].op == 'I') {
                 continue;
-                break;
-            case 'M':
-                Update(address);
-                hit_count++;
-                break;
-            case 'L':
-                Update(address);
-                break;
-            case 'S':
-                Update(address);
-                break;
-            default:
-                break;
+            }
+            if(sweep_access(sw, recs[i].addr) < 0) {
+                fprintf(stderr, "Out of memory in the sweep\n");
+                exit(1);
+            }
+            // The store half of a modify always hits
+            modify_count += recs[i].op == 'M';
+            if(verify_sweep) {
+                addrs[kept] = recs[i].addr;
+                ops[kept] = recs[i].op;
+                kept++;
+            }
         }
-        UpdateTimeStamp();
     }
+    if(trace_error(tr)) {
+        fprintf(stderr, "%s: truncated or corrupt binary trace\n", tracefile_path);
+        exit(1);
+    }
+    trace_close(tr);
+
+    int mismatches = 0;
+    printf("%3s %5s %12s %12s %12s\n", "s", "E", "hits", "misses", "evictions");
+    for(int set_bits = 0; set_bits <= s_max; set_bits++) {
+        for(int ways = 1; ways <= e_max; ways++) {
+            unsigned long long hits, misses, evictions;
+            sweep_counts(sw, set_bits, ways, &hits, &misses, &evictions);
+            hits += modify_count;
+            printf("%3d %5d %12llu %12llu %12llu", set_bits, ways, hits, misses, evictions);
+            if(verify_sweep) {
+                Simulate(set_bits, ways, addrs, ops, kept);
+                if(hits != (unsigned long long)hit_count || misses != (unsigned long long)miss_count ||
+                   evictions != (unsigned long long)replace_count) {
+                    printf("  MISMATCH, direct run: %d %d %d", hit_count, miss_count, replace_count);
+                    mismatches++;
+                }
+            }
+            putchar('\n');
+        }
+    }
+    if(verify_sweep) {
+        printf("%d of %d configurations differ from direct simulation\n", mismatches, (s_max + 1) * e_max);
+    }
+
+    sweep_free(sw);
+    free(addrs);
+    free(ops);
+    if(mismatches) {
+        exit(1);
+    }
+}
+
+// Hierarchy mode: every record goes through the -L levels
+void HierCache() {
+    trace_reader_t *tr = trace_open(tracefile_path, hier_has_icache(hierarchy) ? TRACE_KEEP_INSTR : 0);
+    trace_rec_t recs[TRACE_BATCH];
+    size_t n;
+
+    if(tr == NULL) {
+        fprintf(stderr, "%s: %s\n", tracefile_path, strerror(errno));
+        exit(1);
+    }
+    while((n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            hier_access(hierarchy, recs[i].addr, recs[i].op);
+        }
+    }
+    if(trace_error(tr)) {
+        fprintf(stderr, "%s: truncated or corrupt binary trace\n", tracefile_path);
+        exit(1);
+    }
+    trace_close(tr);
+
+    hier_report(hierarchy, stdout);
+    hier_free(hierarchy);
+}
+
+// Estimate the counts from a sample, and optionally compare with a full run
+void SampleCache() {
+    trace_reader_t *tr = trace_open(tracefile_path, 0);
+    sample_result_t est;
 
-    fclose(fp);
+    if(tr == NULL) {
+        fprintf(stderr, "%s: %s\n", tracefile_path, strerror(errno));
+        exit(1);
+    }
+    S = 1 << s;
+    InitCache();
+    if(sample_run(csim_cache(simulation), tr, &sampling, &est) < 0) {
+        fprintf(stderr, "Nothing sampled, use a smaller ratio or window\n");
+        exit(1);
+    }
+    if(trace_error(tr)) {
+        fprintf(stderr, "%s: truncated or corrupt binary trace\n", tracefile_path);
+        exit(1);
+    }
+    trace_close(tr);
+
+    hit_count = est.hits.value + 0.5;
+    miss_count = est.misses.value + 0.5;
+    replace_count = est.evictions.value + 0.5;
+    printSummary(hit_count, miss_count, replace_count);
+    printf("sampled %llu of %llu accesses (%.1f%%) over %llu %s\n",
+           est.simulated, est.records,
+           est.records > 0 ? 100.0 * est.simulated / est.records : 0.0,
+           est.units, sampling.set_ratio > 1 ? "sets" : "windows");
+    printf("%-10s %14s %14s\n", "", "estimate", "95% interval");
+    printf("%-10s %14.0f %14.0f\n", "hits", est.hits.value, est.hits.ci);
+    printf("%-10s %14.0f %14.0f\n", "misses", est.misses.value, est.misses.ci);
+    printf("%-10s %14.0f %14.0f\n", "evictions", est.evictions.value, est.evictions.ci);
+
+    if(verify_sweep) {
+        FreeCache();
+        ModifyCache();
+        estimate_t *e[3] = { &est.hits, &est.misses, &est.evictions };
+        int full[3] = { hit_count, miss_count, replace_count };
+        const char *names[3] = { "hits", "misses", "evictions" };
+        printf("%-10s %14s %14s %8s\n", "full run", "actual", "error", "inside");
+        for(int i = 0; i < 3; i++) {
+            double err = e[i]->value - full[i];
+            printf("%-10s %14d %+14.0f %8s\n", names[i], full[i], err,
+                   err <= e[i]->ci && -err <= e[i]->ci ? "yes" : "no");
+        }
+    }
     FreeCache();
 }
 
 int main(int argc, char *argv[]) {
+    const char *levels[HIER_MAX_LEVELS];
+    int nlevels = 0;
     int opt;
 
-    while(-1 != (opt = getopt(argc, argv, "hvs:E:b:t:"))) {
+    while(-1 != (opt = getopt(argc, argv, "hvwcs:E:b:t:L:P:m:R:F:j:BA:r:CS:T:"))) {
         switch (opt) {
             case 'h':
                 PrintHelpInfo();
@@ -179,18 +490,180 @@ int main(int argc, char *argv[]) {
             case 't':
                 strcpy(tracefile_path, optarg);
                 break;
+            case 'w':
+                sweep_mode = 1;
+                break;
+            case 'c':
+                verify_sweep = 1;
+                break;
+            case 'L':
+                if(nlevels == HIER_MAX_LEVELS) {
+                    fprintf(stderr, "At most %d levels\n", HIER_MAX_LEVELS);
+                    exit(1);
+                }
+                levels[nlevels++] = optarg;
+                break;
+            case 'P':
+                if((hier_policy = hier_parse_policy(optarg)) < 0) {
+                    fprintf(stderr, "Unknown policy %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                mem_latency = atoi(optarg);
+                break;
+            case 'F': {
+                char err[128];
+                if((prefetcher = prefetch_create(optarg, err, sizeof(err))) == NULL) {
+                    fprintf(stderr, "Bad prefetcher %s\n", err);
+                    exit(1);
+                }
+                break;
+            }
+            case 'A':
+            case 'r':
+                if(attribution == NULL && (attribution = attr_create()) == NULL) {
+                    fprintf(stderr, "Out of memory for attribution\n");
+                    exit(1);
+                }
+                if(opt == 'A') {
+                    attr_top = atoi(optarg);
+                }
+                else {
+                    char err[128];
+                    if(attr_add_region(attribution, optarg, err, sizeof(err)) < 0) {
+                        fprintf(stderr, "Bad region %s\n", err);
+                        exit(1);
+                    }
+                }
+                break;
+            case 'C':
+                classify_misses = 1;
+                break;
+            case 'S':
+                if((sampling.set_ratio = atoi(optarg)) < 2) {
+                    fprintf(stderr, "-S needs a ratio of at least 2\n");
+                    exit(1);
+                }
+                break;
+            case 'T':
+                if(sample_parse_time(&sampling, optarg) < 0) {
+                    fprintf(stderr, "Bad window %s, expected period:warmup:window\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                split_accesses = 1;
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'R':
+                if((replacement = cache_parse_policy(optarg)) < 0) {
+                    fprintf(stderr, "Unknown replacement policy %s\n", optarg);
+                    exit(1);
+                }
+                break;
             default:
                 PrintHelpInfo();
                 break;
         }
     }
 
+    if(prefetcher != NULL && (nlevels > 0 || sweep_mode || replacement == CACHE_OPT)) {
+        fprintf(stderr, "-F only models a single level, and not with -w or opt\n");
+        exit(1);
+    }
+
+    if(attribution != NULL && (nthreads > 1 || nlevels > 0 || sweep_mode || split_accesses ||
+                               replacement == CACHE_OPT)) {
+        fprintf(stderr, "-A/-r attribute a single serial level, and not with -w, -B or opt\n");
+        exit(1);
+    }
+
+    if(classify_misses && (nthreads > 1 || nlevels > 0 || sweep_mode)) {
+        fprintf(stderr, "-C classifies a single serial level, and not with -w\n");
+        exit(1);
+    }
+
+    if(split_accesses && (nthreads > 1 || nlevels > 0 || sweep_mode || replacement == CACHE_OPT)) {
+        fprintf(stderr, "-B only applies to a single serial level, and not with -w or opt\n");
+        exit(1);
+    }
+
+    int sampled = sampling.set_ratio > 1 || sampling.window > 0;
+    if(sampled && (sampling.set_ratio > 1 && sampling.window > 0)) {
+        fprintf(stderr, "-S and -T are separate estimators, pick one\n");
+        exit(1);
+    }
+    if(sampled && (nthreads > 1 || nlevels > 0 || sweep_mode || prefetcher != NULL ||
+                   attribution != NULL || classify_misses || split_accesses ||
+                   replacement == CACHE_OPT)) {
+        fprintf(stderr, "-S/-T sample a plain single level, without -j, -w, -F, -A, -C, -B or opt\n");
+        exit(1);
+    }
+    if(sampled && verify_sweep && strcmp(tracefile_path, "-") == 0) {
+        fprintf(stderr, "-c reads the trace twice, it needs a file rather than stdin\n");
+        exit(1);
+    }
+
+    if(nthreads > 1 && (nlevels > 0 || sweep_mode || prefetcher != NULL || replacement == CACHE_OPT)) {
+        fprintf(stderr, "-j only splits a single level, and not with -w, -F or opt\n");
+        exit(1);
+    }
+
+    if(nlevels > 0) {
+        char err[128];
+        if(replacement == CACHE_OPT) {
+            fprintf(stderr, "opt replacement is only supported for a single level\n");
+            exit(1);
+        }
+        hierarchy = hier_create(hier_policy, mem_latency, replacement);
+        assert(hierarchy != NULL);
+        for(int i = 0; i < nlevels; i++) {
+            if(hier_add_level(hierarchy, levels[i], err, sizeof(err)) < 0) {
+                fprintf(stderr, "Bad level %s\n", err);
+                exit(1);
+            }
+        }
+        HierCache();
+        return 0;
+    }
+
     assert(s > 0 && E > 0 && b > 0);
     assert(tracefile_path != NULL);
 
+    if(sweep_mode) {
+        if(replacement != CACHE_LRU) {
+            fprintf(stderr, "-w relies on LRU stack distances, it cannot sweep %s\n",
+                    cache_policy_name(replacement));
+            exit(1);
+        }
+        SweepCache();
+        return 0;
+    }
+
+    if(sampled) {
+        SampleCache();
+        return 0;
+    }
+
     ModifyCache();
 
     printSummary(hit_count, miss_count, replace_count);
+    if(prefetcher != NULL) {
+        prefetch_report(prefetcher, csim_cache(simulation), stdout);
+        prefetch_free(prefetcher);
+    }
+    if(attribution != NULL) {
+        attr_report(attribution, attr_top, stdout);
+        attr_free(attribution);
+    }
+    if(classifier != NULL) {
+        classify_report(classifier, stdout);
+        classify_free(classifier);
+    }
+    FreeCache();
 
     return 0;
 }
@@ -12,6 +12,8 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "csim-lib.h"
+#include "trans-trace.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -41,6 +43,197 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * In-process evaluation. Each function runs in a child process of its
+ * own, so a crash or a hang in it (or in anything it calls) costs that
+ * function alone, as a crashing tracegen does under -V. The child traces
+ * into its own simulator and writes its counts back through a pipe.
+ *
+ * The counts cover A and B only. The lackey trace that -V scores has
+ * five accesses more: tracegen's two marker stores (0x18c08c and
+ * 0x18c08d), its load of the func_list pointer (0x18c0a0) and its loads
+ * of M and N (0x18c080 and 0x18c084). Each costs at most one miss.
+ */
+#define EVAL_TIMEOUT 20         /* seconds a single function may take */
+
+struct eval_result {
+    int correct;
+    unsigned int hits, misses, evictions;
+};
+
+struct eval_child {
+    pid_t pid;
+    int func;
+    int fd;                     /* read end of the child's pipe */
+};
+
+/* A, then B at mat + MAXN * MAXN, back to back as in tracegen */
+static int mat[2 * MAXN * MAXN] __attribute__((aligned(64)));
+static int expect[MAXN * MAXN];
+
+/*
+ * eval_one - Run func_list[i] under the tracer and return its counts
+ */
+static void eval_one(int i, unsigned int s, unsigned int E, unsigned int b,
+                     struct eval_result *r)
+{
+    int *A = mat, *B = mat + MAXN * MAXN;
+    csim_config_t cfg = { .s = s, .E = E, .b = b, .policy = CACHE_LRU };
+    csim_counts_t counts;
+    csim_t *sim;
+
+    initMatrix(M, N, (void *)A, (void *)B);
+    correctTrans(M, N, (void *)A, (void *)expect);
+
+    sim = csim_create(&cfg);
+    assert(sim);
+    trans_trace_start(sim, A, B + MAXN * MAXN);
+    (*func_list[i].func_ptr)(M, N, (void *)A, (void *)B);
+    trans_trace_stop();
+    csim_counts(sim, &counts);
+    csim_free(sim);
+
+    r->correct = memcmp(B, expect, (size_t)M * N * sizeof(int)) == 0;
+    r->hits = counts.hits;
+    r->misses = counts.misses;
+    r->evictions = counts.evictions;
+}
+
+/*
+ * eval_start - Fork a child that evaluates func_list[i]
+ */
+static struct eval_child eval_start(int i, unsigned int s, unsigned int E, unsigned int b)
+{
+    struct eval_child child = { -1, i, -1 };
+    struct eval_result r;
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    if ((child.pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (child.pid == 0) {
+        close(fds[0]);
+        signal(SIGSEGV, SIG_DFL);
+        signal(SIGALRM, SIG_DFL);
+        alarm(EVAL_TIMEOUT);
+        eval_one(i, s, E, b, &r);
+        _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    child.fd = fds[0];
+    return child;
+}
+
+/*
+ * eval_finish - Collect a child that has exited with the given status.
+ *     Returns 0 if it ran to the end, or else the signal that stopped it
+ *     (-1 if it exited without reporting).
+ */
+static int eval_finish(struct eval_child *child, int status, struct eval_result *r)
+{
+    ssize_t len;
+
+    memset(r, 0, sizeof(*r));
+    len = read(child->fd, r, sizeof(*r));
+    close(child->fd);
+    child->pid = -1;
+    if (WIFSIGNALED(status))
+        return WTERMSIG(status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || len != sizeof(*r))
+        return -1;
+    return 0;
+}
+
+/*
+ * eval_report_death - Report a function whose child did not finish
+ */
+static void eval_report_death(int i, int sig)
+{
+    if (sig == SIGALRM)
+        printf("Validation error at function %d! It ran for over %d seconds.\n", i, EVAL_TIMEOUT);
+    else if (sig > 0)
+        printf("Validation error at function %d! It died of signal %d.\n", i, sig);
+    else
+        printf("Validation error at function %d! It exited without reporting.\n", i);
+}
+
+/*
+ * eval_perf_inproc - Evaluate the registered transpose functions without
+ *     valgrind, up to njobs at a time. test-trans links a build of
+ *     trans.c whose loads and stores call hooks (see trans-trace.c);
+ *     those that touch A or B go straight into the simulator, so each
+ *     function costs one call.
+ */
+void eval_perf_inproc(unsigned int s, unsigned int E, unsigned int b, int njobs)
+{
+    int i, status, running = 0, next = 0;
+    int died[MAX_TRANS_FUNCS];
+    struct eval_child children[MAX_TRANS_FUNCS];
+    struct eval_result r;
+    pid_t pid;
+
+    registerFunctions();
+    if (njobs > func_counter)
+        njobs = func_counter;
+    if (njobs < 1)
+        njobs = 1;
+    printf("Evaluating performance in-process (s=%d, E=%d, b=%d), %d at a time\n",
+           s, E, b, njobs);
+
+    for (i = 0; i < func_counter; i++) {
+        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0)
+            results.funcid = i; /* remember which function is the submission */
+    }
+
+    while (next < func_counter || running > 0) {
+        if (next < func_counter && running < njobs) {
+            children[next] = eval_start(next, s, E, b);
+            next++;
+            running++;
+            continue;
+        }
+        if ((pid = wait(&status)) < 0) {
+            perror("wait");
+            exit(1);
+        }
+        for (i = 0; i < next && children[i].pid != pid; i++)
+            ;
+        if (i == next)
+            continue;
+        running--;
+        died[i] = eval_finish(&children[i], status, &r);
+        func_list[i].correct = died[i] == 0 && r.correct;
+        func_list[i].num_hits = r.hits;
+        func_list[i].num_misses = r.misses;
+        func_list[i].num_evictions = r.evictions;
+    }
+
+    /* Report in registration order, whatever order they finished in */
+    for (i = 0; i < func_counter; i++) {
+        if (died[i] != 0)
+            eval_report_death(i, died[i]);
+        if (!func_list[i].correct) {
+            if (died[i] == 0)
+                printf("Validation error at function %d!\n", i);
+            printf("Skipping performance evaluation for this function.\n");
+            continue;
+        }
+        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+               i, func_list[i].description, func_list[i].num_hits,
+               func_list[i].num_misses, func_list[i].num_evictions);
+        if (results.funcid == i) {
+            results.correct = 1;
+            results.misses = func_list[i].num_misses;
+        }
+    }
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
@@ -151,6 +344,18 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
         func_list[i].num_evictions = evictions;
         printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
                i, func_list[i].description, hits, misses, evictions);
+
+        /* Side by side with what the default in-process run reports */
+        struct eval_child child = eval_start(i, s, E, b);
+        struct eval_result r;
+        int status, sig;
+        waitpid(child.pid, &status, 0);
+        if ((sig = eval_finish(&child, status, &r)) != 0)
+            eval_report_death(i, sig);
+        else
+            printf("func %u in-process (A and B only, 5 tracegen accesses fewer): "
+                   "hits:%u, misses:%u, evictions:%u\n",
+                   i, r.hits, r.misses, r.evictions);
     
         /* If it is transpose_submit(), record number of misses */
         if (results.funcid == i) {
@@ -164,9 +369,14 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hV] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -V          Trace with valgrind and score with csim-ref instead, and\n");
+    printf("              print the in-process counts too. Those leave out five\n");
+    printf("              accesses tracegen makes: two marker stores and the loads\n");
+    printf("              of func_list, M and N.\n");
+    printf("  -j <num>    Evaluate this many functions at a time (default: all CPUs).\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -198,8 +408,10 @@ void sigalrm_handler(int signum){
 int main(int argc, char* argv[])
 {
     char c;
+    int use_valgrind = 0;
+    int njobs = sysconf(_SC_NPROCESSORS_ONLN);
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:hVj:")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +419,12 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'V':
+            use_valgrind = 1;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -243,7 +461,10 @@ int main(int argc, char* argv[])
     alarm(120);
 
     /* Check the performance of the student's transpose function */
-    eval_perf(5, 1, 5);
+    if (use_valgrind)
+        eval_perf(5, 1, 5);
+    else
+        eval_perf_inproc(5, 1, 5, njobs);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
@@ -0,0 +1,120 @@
+/*
+ * tracebin.c - Convert valgrind lackey traces to the compact binary
+ * trace format that csim replays directly, and back.
+ *
+ * Usage: ./tracebin [-hizd] <in> <out>     ('-' is stdin/stdout)
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "csim-trace.h"
+
+#define TRACE_BATCH 4096
+
+static void usage(char *argv[]) {
+    printf("Usage: %s [-hizd] <in> <out>\n", argv[0]);
+    puts("Options:");
+    puts("  -h   Print this help message.");
+    puts("  -i   Keep instruction fetch (I) records.");
+    puts("  -z   zlib-compress the binary blocks.");
+    puts("  -d   Decode: write a binary trace back out as lackey text.");
+    puts("Either file may be '-' for stdin/stdout.");
+    puts("Examples:");
+    puts("  linux>  ./tracebin -z traces/long.trace long.bin");
+    puts("  linux>  ./csim -s 5 -E 1 -b 5 -t long.bin");
+}
+
+int main(int argc, char *argv[]) {
+    int read_flags = 0, write_flags = 0, decode = 0;
+    int opt;
+
+    while(-1 != (opt = getopt(argc, argv, "hizd"))) {
+        switch (opt) {
+            case 'i':
+                read_flags |= TRACE_KEEP_INSTR;
+                break;
+            case 'z':
+                write_flags |= TRACE_COMPRESS;
+                break;
+            case 'd':
+                decode = 1;
+                break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+    if(argc - optind != 2) {
+        usage(argv);
+        exit(1);
+    }
+    const char *in = argv[optind], *out = argv[optind + 1];
+
+    /* Decoding is lossless, so it passes every record through */
+    trace_reader_t *tr = trace_open(in, decode ? TRACE_KEEP_INSTR : read_flags);
+    if(tr == NULL) {
+        fprintf(stderr, "%s: %s\n", in, strerror(errno));
+        exit(1);
+    }
+
+    FILE *fp = NULL;
+    trace_writer_t *tw = NULL;
+    if(decode) {
+        fp = strcmp(out, "-") ? fopen(out, "w") : stdout;
+    }
+    else {
+        tw = trace_writer_open(out, write_flags);
+    }
+    if(fp == NULL && tw == NULL) {
+        fprintf(stderr, "%s: %s\n", out, strerror(errno));
+        exit(1);
+    }
+
+    trace_rec_t recs[TRACE_BATCH];
+    size_t n, total = 0;
+    int failed = 0;
+    while(!failed && (n = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        total += n;
+        if(tw != NULL) {
+            failed = trace_write(tw, recs, n) < 0;
+            continue;
+        }
+        for(size_t i = 0; i < n && !failed; i++) {
+            /* Same layout as lackey: instruction fetches are not indented */
+            if(recs[i].op == 'I') {
+                failed = fprintf(fp, "I  %08llx,%u\n", recs[i].addr, recs[i].size) < 0;
+            }
+            else {
+                failed = fprintf(fp, " %c %08llx,%u\n", recs[i].op, recs[i].addr, recs[i].size) < 0;
+            }
+        }
+    }
+
+    if(trace_error(tr)) {
+        fprintf(stderr, "%s: truncated or corrupt binary trace\n", in);
+        failed = 1;
+    }
+    trace_close(tr);
+    if(tw != NULL) {
+        failed |= trace_writer_close(tw) < 0;
+    }
+    else if(fp == stdout) {
+        failed |= fflush(fp) != 0;
+    }
+    else {
+        failed |= fclose(fp) != 0;
+    }
+    if(failed) {
+        fprintf(stderr, "%s: write failed\n", out);
+        exit(1);
+    }
+
+    fprintf(stderr, "%zu records\n", total);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * trans-simd.c - SIMD in-register transposes for running on real hardware
+ *
+ * The matrix is walked in TRANS_SIMD_BLOCK x TRANS_SIMD_BLOCK blocks so
+ * the rows of A and the rows of B a block touches stay cached. Inside a
+ * block, every full 8x8 tile is loaded as eight rows, transposed with
+ * unpack/permute sequences and stored as eight rows of B: AVX2 does it
+ * in one pass of 256-bit registers, SSE2 as four 4x4 transposes. The
+ * ragged right and bottom edges (e.g. of 61x67) are copied one int at a
+ * time inside the last block of each row and column of blocks, while
+ * that block is still cached; a separate pass over the edges afterwards
+ * cost more than the tiles on large ragged shapes such as 2047x2053.
+ *
+ * SSE2 is part of x86-64, so it is always there. The AVX2 kernel is
+ * compiled with a target attribute rather than -mavx2 and only called
+ * once CPUID (via __builtin_cpu_supports) says the CPU and OS allow it.
+ * trans_simd() still takes SSE2 when M or N is not a multiple of 8: rows
+ * then start at every alignment, a misaligned 32-byte access straddles
+ * two cache lines more often than a 16-byte one does, and AVX2 measured
+ * about 10% slower than SSE2 on 2047x2053 and 4093x4099.
+ */
+#include <immintrin.h>
+#include "trans-simd.h"
+
+#define TRANS_SIMD_BLOCK 32     // ints per side of a cache block; a multiple of 8
+
+// 4x4 tile of ints, rows lda apart in a, into rows ldb apart in b
+static inline void Tile4x4(const int *a, int lda, int *b, int ldb) {
+    __m128i r0 = _mm_loadu_si128((const __m128i *)(a + 0 * lda));
+    __m128i r1 = _mm_loadu_si128((const __m128i *)(a + 1 * lda));
+    __m128i r2 = _mm_loadu_si128((const __m128i *)(a + 2 * lda));
+    __m128i r3 = _mm_loadu_si128((const __m128i *)(a + 3 * lda));
+
+    // a00 a10 a01 a11, a20 a30 a21 a31, a02 a12 a03 a13, a22 a32 a23 a33
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i *)(b + 0 * ldb), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(b + 1 * ldb), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(b + 2 * ldb), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(b + 3 * ldb), _mm_unpackhi_epi64(t2, t3));
+}
+
+static void Tile8x8Sse2(const int *a, int lda, int *b, int ldb) {
+    Tile4x4(a, lda, b, ldb);
+    Tile4x4(a + 4, lda, b + 4 * ldb, ldb);
+    Tile4x4(a + 4 * lda, lda, b + 4, ldb);
+    Tile4x4(a + 4 * lda + 4, lda, b + 4 * ldb + 4, ldb);
+}
+
+__attribute__((target("avx2")))
+static void Tile8x8Avx2(const int *a, int lda, int *b, int ldb) {
+    __m256i r0 = _mm256_loadu_si256((const __m256i *)(a + 0 * lda));
+    __m256i r1 = _mm256_loadu_si256((const __m256i *)(a + 1 * lda));
+    __m256i r2 = _mm256_loadu_si256((const __m256i *)(a + 2 * lda));
+    __m256i r3 = _mm256_loadu_si256((const __m256i *)(a + 3 * lda));
+    __m256i r4 = _mm256_loadu_si256((const __m256i *)(a + 4 * lda));
+    __m256i r5 = _mm256_loadu_si256((const __m256i *)(a + 5 * lda));
+    __m256i r6 = _mm256_loadu_si256((const __m256i *)(a + 6 * lda));
+    __m256i r7 = _mm256_loadu_si256((const __m256i *)(a + 7 * lda));
+
+    // Pairs of rows interleaved: a00 a10 a01 a11 | a04 a14 a05 a15, ...
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+    __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+    __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+
+    // Quarter columns: a00 a10 a20 a30 | a04 a14 a24 a34, ...
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    // Join the halves across the 128-bit lanes
+    _mm256_storeu_si256((__m256i *)(b + 0 * ldb), _mm256_permute2x128_si256(u0, u4, 0x20));
+    _mm256_storeu_si256((__m256i *)(b + 1 * ldb), _mm256_permute2x128_si256(u1, u5, 0x20));
+    _mm256_storeu_si256((__m256i *)(b + 2 * ldb), _mm256_permute2x128_si256(u2, u6, 0x20));
+    _mm256_storeu_si256((__m256i *)(b + 3 * ldb), _mm256_permute2x128_si256(u3, u7, 0x20));
+    _mm256_storeu_si256((__m256i *)(b + 4 * ldb), _mm256_permute2x128_si256(u0, u4, 0x31));
+    _mm256_storeu_si256((__m256i *)(b + 5 * ldb), _mm256_permute2x128_si256(u1, u5, 0x31));
+    _mm256_storeu_si256((__m256i *)(b + 6 * ldb), _mm256_permute2x128_si256(u2, u6, 0x31));
+    _mm256_storeu_si256((__m256i *)(b + 7 * ldb), _mm256_permute2x128_si256(u3, u7, 0x31));
+}
+
+typedef void (*tile_fn)(const int *a, int lda, int *b, int ldb);
+
+// Blocked walk shared by both kernels; a is N x M, b is M x N
+static inline void Transpose(int M, int N, const int *a, int *b, tile_fn tile) {
+    for(int bi = 0; bi < N; bi += TRANS_SIMD_BLOCK) {
+        for(int bj = 0; bj < M; bj += TRANS_SIMD_BLOCK) {
+            int ei = bi + TRANS_SIMD_BLOCK < N ? bi + TRANS_SIMD_BLOCK : N;
+            int ej = bj + TRANS_SIMD_BLOCK < M ? bj + TRANS_SIMD_BLOCK : M;
+            int ti = bi + ((ei - bi) & ~7), tj = bj + ((ej - bj) & ~7);
+            for(int i = bi; i < ti; i += 8) {
+                for(int j = bj; j < tj; j += 8) {
+                    tile(a + (size_t)i * M + j, M, b + (size_t)j * N + i, N);
+                }
+            }
+            // Ragged edges of this block: its last columns, then its last rows
+            for(int j = tj; j < ej; j++) {
+                for(int i = bi; i < ei; i++) {
+                    b[(size_t)j * N + i] = a[(size_t)i * M + j];
+                }
+            }
+            for(int j = bj; j < tj; j++) {
+                for(int i = ti; i < ei; i++) {
+                    b[(size_t)j * N + i] = a[(size_t)i * M + j];
+                }
+            }
+        }
+    }
+}
+
+void trans_simd_sse2(int M, int N, int A[N][M], int B[M][N]) {
+    Transpose(M, N, &A[0][0], &B[0][0], Tile8x8Sse2);
+}
+
+void trans_simd_avx2(int M, int N, int A[N][M], int B[M][N]) {
+    Transpose(M, N, &A[0][0], &B[0][0], Tile8x8Avx2);
+}
+
+int trans_simd_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+void trans_simd(int M, int N, int A[N][M], int B[M][N]) {
+    if(M % 8 == 0 && N % 8 == 0 && trans_simd_has_avx2()) {
+        trans_simd_avx2(M, N, A, B);
+    }
+    else {
+        trans_simd_sse2(M, N, A, B);
+    }
+}
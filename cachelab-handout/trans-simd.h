@@ -0,0 +1,21 @@
+/*
+ * trans-simd.h - SIMD in-register transposes for running on real hardware
+ *
+ * These are for wall-clock speed, not for the graded miss counts: they
+ * move whole 8x8 tiles through vector registers instead of one int at a
+ * time. Same prototype as the trans.c functions.
+ */
+
+#ifndef TRANS_SIMD_H
+#define TRANS_SIMD_H
+
+// trans_simd - The fastest kernel for this CPU (CPUID) and shape
+void trans_simd(int M, int N, int A[N][M], int B[M][N]);
+
+// The kernels themselves; trans_simd_avx2() needs trans_simd_has_avx2()
+void trans_simd_sse2(int M, int N, int A[N][M], int B[M][N]);
+void trans_simd_avx2(int M, int N, int A[N][M], int B[M][N]);
+
+int trans_simd_has_avx2(void);
+
+#endif /* TRANS_SIMD_H */
@@ -0,0 +1,52 @@
+/*
+ * trans-trace.c - In-process tracing of transpose functions
+ *
+ * TRACE_CFLAGS builds trans.c with gcc's kernel address sanitizer in
+ * call mode, without stack or global instrumentation: every load and
+ * store through a pointer becomes a call to one of the hooks below,
+ * which a kernel would otherwise provide. Locals stay in registers or
+ * unchecked stack slots, just as the grader's filter drops stack
+ * references from valgrind traces.
+ */
+#include <stddef.h>
+#include "trans-trace.h"
+
+static __thread csim_t *sink;
+static __thread unsigned long long sink_lo, sink_len;
+
+void trans_trace_start(csim_t *sim, const void *lo, const void *hi) {
+    sink_lo = (unsigned long long)(size_t)lo;
+    sink_len = (unsigned long long)(size_t)hi - sink_lo;
+    sink = sim;
+}
+
+void trans_trace_stop(void) {
+    sink = NULL;
+}
+
+static inline void Record(unsigned long long addr, unsigned int size, char op) {
+    if(sink != NULL && addr - sink_lo < sink_len) {
+        csim_access(sink, addr, size, op);
+    }
+}
+
+#define TRACE_HOOKS(size) \
+    void __asan_load##size##_noabort(unsigned long addr) { Record(addr, size, 'L'); } \
+    void __asan_store##size##_noabort(unsigned long addr) { Record(addr, size, 'S'); }
+
+TRACE_HOOKS(1)
+TRACE_HOOKS(2)
+TRACE_HOOKS(4)
+TRACE_HOOKS(8)
+TRACE_HOOKS(16)
+
+void __asan_loadN_noabort(unsigned long addr, unsigned long size) {
+    Record(addr, size, 'L');
+}
+
+void __asan_storeN_noabort(unsigned long addr, unsigned long size) {
+    Record(addr, size, 'S');
+}
+
+void __asan_handle_no_return(void) {
+}
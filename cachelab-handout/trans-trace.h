@@ -0,0 +1,22 @@
+/*
+ * trans-trace.h - In-process tracing of transpose functions
+ *
+ * A build of trans.c compiled with TRACE_CFLAGS (see the Makefile) calls
+ * a hook for every load and store it makes. Between trans_trace_start()
+ * and trans_trace_stop() the hooks feed the accesses that fall inside
+ * the matrices straight to a csim_t, so a transpose is scored in one
+ * call instead of a valgrind run and a trace file.
+ */
+
+#ifndef TRANS_TRACE_H
+#define TRANS_TRACE_H
+
+#include "csim-lib.h"
+
+// trans_trace_start - Until trans_trace_stop(), send the calling thread's
+// instrumented accesses to [lo, hi) to sim. Other threads are unaffected.
+void trans_trace_start(csim_t *sim, const void *lo, const void *hi);
+
+void trans_trace_stop(void);
+
+#endif /* TRANS_TRACE_H */
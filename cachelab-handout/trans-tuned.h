@@ -0,0 +1,28 @@
+/*
+ * trans-tuned.h - Transpose variant per shape, picked by transtune for
+ *     s=5 E=1 b=5. Regenerate with "make tune" rather than editing.
+ */
+/* Transpose kernels the autotuner chooses from (see trans_variant()) */
+#define TRANS_TILED     0   /* tile_w x tile_h tiles, shaped by flags */
+#define TRANS_STAGED8   1   /* 8x8 tiles staged in registers */
+#define TRANS_PHASED8   2   /* 8x8 tiles moved as 4x4 quarters in three phases */
+#define TRANS_NKERNELS  3
+
+/* TRANS_TILED flags */
+#define TRANS_COL_ORDER  1  /* visit tiles down the columns of A */
+#define TRANS_COL_INNER  2  /* walk each tile column by column */
+#define TRANS_DEFER_DIAG 4  /* copy a row's diagonal element last */
+#define TRANS_NFLAGS     8
+
+/* Run one kernel; the 8x8 ones fall back to 8x8 tiles unless 8 | M, N */
+void trans_variant(int M, int N, int A[N][M], int B[M][N],
+                   int kernel, int tile_w, int tile_h, int flags);
+
+#define TRANS_TUNED_TABLE \
+    /* 8x8 register-staged, 284 misses */ \
+    TRANS_TUNED(32, 32, TRANS_STAGED8, 8, 8, 0) \
+    /* 8x8 three-phase, 1176 misses */ \
+    TRANS_TUNED(64, 64, TRANS_PHASED8, 8, 8, 0) \
+    /* 17x2 tiles, column order, diagonal last, 1803 misses */ \
+    TRANS_TUNED(61, 67, TRANS_TILED, 17, 2, TRANS_COL_ORDER | TRANS_DEFER_DIAG) \
+
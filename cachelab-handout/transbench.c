@@ -0,0 +1,151 @@
+/*
+ * transbench.c - Wall-clock benchmark of the transposes on this machine
+ *
+ * Times trans(), transpose_submit() and the SIMD kernels of trans-simd.c
+ * on each shape, checking every result against correctTrans(). trans.c
+ * is built with -O2 here (trans-O2.o), unlike the -O0 build the graded
+ * runs use, so the comparison is between kernels and not optimization
+ * levels.
+ *
+ * Usage: ./transbench [-h] [-r <num>] [MxN ...]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cachelab.h"
+#include "trans-simd.h"
+
+#define MAXDIM 16384
+#define MIN_BYTES (256ULL << 20)    // repeat small shapes until this much is moved
+
+extern void trans(int M, int N, int A[N][M], int B[M][N]);
+extern void transpose_submit(int M, int N, int A[N][M], int B[M][N]);
+
+typedef struct {
+    const char *name;
+    void (*func)(int M, int N, int A[N][M], int B[M][N]);
+} kernel_t;
+
+static void usage(char *argv[]) {
+    printf("Usage: %s [-h] [-r <num>] [MxN ...]\n", argv[0]);
+    puts("Options:");
+    puts("  -h         Print this help message.");
+    puts("  -r <num>   Best of this many timed runs per kernel (default 5).");
+    puts("Shapes default to 61x67, 64x64, 1024x1024, 2048x2048 and 2047x2053.");
+    puts("Examples:");
+    puts("  linux>  ./transbench");
+    puts("  linux>  ./transbench -r 10 4096x4096 4093x4099");
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Best time of runs rounds, each transposing reps times; -1 if B is wrong
+static double Time(const kernel_t *k, int M, int N, int *A, int *B, const int *expect,
+                   int reps, int runs) {
+    double best = 0;
+
+    memset(B, 0, (size_t)M * N * sizeof(int));
+    k->func(M, N, (void *)A, (void *)B);
+    if(memcmp(B, expect, (size_t)M * N * sizeof(int)) != 0) {
+        return -1;
+    }
+    for(int r = 0; r < runs; r++) {
+        double start = now();
+        for(int i = 0; i < reps; i++) {
+            k->func(M, N, (void *)A, (void *)B);
+        }
+        double t = (now() - start) / reps;
+        if(r == 0 || t < best) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *defaults[] = { "61x67", "64x64", "1024x1024", "2048x2048", "2047x2053" };
+    kernel_t kernels[] = {
+        { "trans", trans },
+        { "transpose_submit", transpose_submit },
+        { "simd sse2", trans_simd_sse2 },
+        { "simd avx2", trans_simd_avx2 },
+    };
+    int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+    int runs = 5;
+    int opt;
+
+    while(-1 != (opt = getopt(argc, argv, "hr:"))) {
+        switch (opt) {
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+    if(runs < 1) {
+        usage(argv);
+        exit(1);
+    }
+    if(!trans_simd_has_avx2()) {
+        nkernels--;
+    }
+
+    const char **shapes = defaults;
+    int nshapes = sizeof(defaults) / sizeof(defaults[0]);
+    if(optind < argc) {
+        shapes = (const char **)argv + optind;
+        nshapes = argc - optind;
+    }
+
+    printf("trans_simd() uses %s on this CPU\n",
+           trans_simd_has_avx2() ? "AVX2 when 8 divides M and N, else SSE2" : "SSE2");
+    printf("%-11s %-18s %12s %10s %9s\n", "shape", "kernel", "time (us)", "GB/s", "speedup");
+    for(int s = 0; s < nshapes; s++) {
+        int M, N, len;
+        if(sscanf(shapes[s], "%dx%d%n", &M, &N, &len) != 2 || shapes[s][len] != '\0' ||
+           M < 1 || N < 1 || M > MAXDIM || N > MAXDIM) {
+            fprintf(stderr, "Bad shape %s, expected MxN with both at most %d\n", shapes[s], MAXDIM);
+            exit(1);
+        }
+
+        size_t bytes = (size_t)M * N * sizeof(int);
+        int *A = malloc(bytes), *B = malloc(bytes), *expect = malloc(bytes);
+        if(A == NULL || B == NULL || expect == NULL) {
+            fprintf(stderr, "Out of memory for %s\n", shapes[s]);
+            exit(1);
+        }
+        initMatrix(M, N, (void *)A, (void *)B);
+        correctTrans(M, N, (void *)A, (void *)expect);
+
+        int reps = MIN_BYTES / (2 * bytes) + 1;
+        double base = 0;
+        for(int k = 0; k < nkernels; k++) {
+            double t = Time(&kernels[k], M, N, A, B, expect, reps, runs);
+            if(t < 0) {
+                printf("%-11s %-18s %12s\n", shapes[s], kernels[k].name, "WRONG");
+                continue;
+            }
+            if(k == 0) {
+                base = t;
+            }
+            printf("%-11s %-18s %12.2f %10.2f %8.2fx\n", shapes[s], kernels[k].name,
+                   t * 1e6, 2.0 * bytes / t / 1e9, base / t);
+        }
+        free(A);
+        free(B);
+        free(expect);
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * transtune.c - Pick the transpose variant with the fewest misses for
+ * each matrix shape, and write the table transpose_submit() dispatches on.
+ *
+ * Every kernel trans_variant() offers is run on an instrumented build of
+ * trans.c (see trans-trace.c), with its accesses going straight into an
+ * in-process simulator of the target cache, so a full search takes well
+ * under a second and needs neither valgrind nor trace files.
+ *
+ * Usage: ./transtune [-hv] [-s <num>] [-E <num>] [-b <num>] [-o <file>] [MxN ...]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "cachelab.h"
+#include "csim-lib.h"
+#include "trans-trace.h"
+#include "trans-tuned.h"
+
+#define MAXN 256
+
+static const int tile_sizes[] = { 2, 4, 6, 8, 12, 16, 17, 18, 20, 23, 24, 32 };
+#define NTILES (int)(sizeof(tile_sizes) / sizeof(tile_sizes[0]))
+
+// Written ahead of the table: trans.c is handed in with trans-tuned.h
+// against a stock cachelab.h, so the kernel names live here
+static const char trans_decls[] =
+    "/* Transpose kernels the autotuner chooses from (see trans_variant()) */\n"
+    "#define TRANS_TILED     0   /* tile_w x tile_h tiles, shaped by flags */\n"
+    "#define TRANS_STAGED8   1   /* 8x8 tiles staged in registers */\n"
+    "#define TRANS_PHASED8   2   /* 8x8 tiles moved as 4x4 quarters in three phases */\n"
+    "#define TRANS_NKERNELS  3\n"
+    "\n"
+    "/* TRANS_TILED flags */\n"
+    "#define TRANS_COL_ORDER  1  /* visit tiles down the columns of A */\n"
+    "#define TRANS_COL_INNER  2  /* walk each tile column by column */\n"
+    "#define TRANS_DEFER_DIAG 4  /* copy a row's diagonal element last */\n"
+    "#define TRANS_NFLAGS     8\n"
+    "\n"
+    "/* Run one kernel; the 8x8 ones fall back to 8x8 tiles unless 8 | M, N */\n"
+    "void trans_variant(int M, int N, int A[N][M], int B[M][N],\n"
+    "                   int kernel, int tile_w, int tile_h, int flags);\n"
+    "\n";
+
+// A and B back to back, as tracegen lays them out, so that A[i][j] and
+// B[i][j] share a set just as they do under the grader
+static int mat[2][MAXN * MAXN] __attribute__((aligned(64)));
+static int expect[MAXN * MAXN];
+
+typedef struct {
+    int kernel, tile_w, tile_h, flags;
+    unsigned long long misses;
+} variant_t;
+
+static void usage(char *argv[]) {
+    printf("Usage: %s [-hv] [-s <num>] [-E <num>] [-b <num>] [-o <file>] [MxN ...]\n", argv[0]);
+    puts("Options:");
+    puts("  -h         Print this help message.");
+    puts("  -v         List every variant tried.");
+    puts("  -s <num>   Number of set index bits (default 5).");
+    puts("  -E <num>   Number of lines per set (default 1).");
+    puts("  -b <num>   Number of block offset bits (default 5).");
+    puts("  -o <file>  Write the dispatch table here instead of stdout.");
+    puts("Shapes default to the graded 32x32, 64x64 and 61x67.");
+    puts("Examples:");
+    puts("  linux>  ./transtune -o trans-tuned.h");
+    puts("  linux>  ./transtune -s 6 -E 2 -b 6 32x32 48x40");
+}
+
+// flags as the C expression the table spells them with
+static const char *flag_names(int flags, char *buf, size_t len) {
+    static const char *names[] = { "TRANS_COL_ORDER", "TRANS_COL_INNER", "TRANS_DEFER_DIAG" };
+    size_t used = 0;
+
+    buf[0] = '\0';
+    for(int i = 0; i < 3; i++) {
+        if(flags & 1 << i) {
+            used += snprintf(buf + used, len - used, "%s%s", used ? " | " : "", names[i]);
+        }
+    }
+    return used ? buf : "0";
+}
+
+static const char *describe(const variant_t *v, char *buf, size_t len) {
+    if(v->kernel == TRANS_STAGED8) {
+        return "8x8 register-staged";
+    }
+    if(v->kernel == TRANS_PHASED8) {
+        return "8x8 three-phase";
+    }
+    snprintf(buf, len, "%dx%d tiles%s%s%s", v->tile_w, v->tile_h,
+             v->flags & TRANS_COL_ORDER ? ", column order" : "",
+             v->flags & TRANS_COL_INNER ? ", column walk" : "",
+             v->flags & TRANS_DEFER_DIAG ? ", diagonal last" : "");
+    return buf;
+}
+
+// Run one variant through a fresh cache. Returns -1 if it got B wrong.
+static int Evaluate(const csim_config_t *cfg, int M, int N, variant_t *v) {
+    csim_t *sim = csim_create(cfg);
+    csim_counts_t counts;
+
+    if(sim == NULL) {
+        fprintf(stderr, "Cannot allocate a cache of %d sets\n", 1 << cfg->s);
+        exit(1);
+    }
+    memset(mat[1], 0, sizeof(mat[1]));
+    trans_trace_start(sim, mat, mat + 2);
+    trans_variant(M, N, (void *)mat[0], (void *)mat[1], v->kernel, v->tile_w, v->tile_h, v->flags);
+    trans_trace_stop();
+    csim_counts(sim, &counts);
+    csim_free(sim);
+
+    v->misses = counts.misses;
+    return memcmp(mat[1], expect, (size_t)M * N * sizeof(int)) == 0 ? 0 : -1;
+}
+
+// Try every variant on one shape and keep the best; ties go to the first
+static variant_t Tune(const csim_config_t *cfg, int M, int N, int verbose, unsigned long long *naive) {
+    variant_t best = { .misses = ~0ULL }, v;
+    char buf[128];
+
+    initMatrix(M, N, (void *)mat[0], (void *)mat[1]);
+    correctTrans(M, N, (void *)mat[0], (void *)expect);
+
+    // The plain row-wise scan is one big tile
+    v = (variant_t) { TRANS_TILED, M, N, 0, 0 };
+    Evaluate(cfg, M, N, &v);
+    *naive = v.misses;
+
+    for(int kernel = TRANS_NKERNELS - 1; kernel >= TRANS_TILED; kernel--) {
+        if(kernel != TRANS_TILED && (M % 8 != 0 || N % 8 != 0)) {
+            continue;
+        }
+        int tiled = kernel == TRANS_TILED;
+        for(int w = 0; w < (tiled ? NTILES : 1); w++) {
+            for(int h = 0; h < (tiled ? NTILES : 1); h++) {
+                for(int flags = 0; flags < (tiled ? TRANS_NFLAGS : 1); flags++) {
+                    v = (variant_t) { kernel, tiled ? tile_sizes[w] : 8, tiled ? tile_sizes[h] : 8, flags, 0 };
+                    if(Evaluate(cfg, M, N, &v) < 0) {
+                        fprintf(stderr, "%dx%d: %s gives a wrong transpose\n", M, N,
+                                describe(&v, buf, sizeof(buf)));
+                        exit(1);
+                    }
+                    if(verbose) {
+                        fprintf(stderr, "%dx%d %-50s %8llu\n", M, N, describe(&v, buf, sizeof(buf)), v.misses);
+                    }
+                    if(v.misses < best.misses) {
+                        best = v;
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *graded[] = { "32x32", "64x64", "61x67" };
+    static const char *kernel_names[TRANS_NKERNELS] = { "TRANS_TILED", "TRANS_STAGED8", "TRANS_PHASED8" };
+    csim_config_t cfg = { .s = 5, .E = 1, .b = 5, .policy = CACHE_LRU };
+    const char *out = NULL;
+    int verbose = 0;
+    int opt;
+
+    while(-1 != (opt = getopt(argc, argv, "hvs:E:b:o:"))) {
+        switch (opt) {
+            case 'v':
+                verbose = 1;
+                break;
+            case 's':
+                cfg.s = atoi(optarg);
+                break;
+            case 'E':
+                cfg.E = atoi(optarg);
+                break;
+            case 'b':
+                cfg.b = atoi(optarg);
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+    if(cfg.s < 0 || cfg.E < 1 || cfg.b < 0) {
+        usage(argv);
+        exit(1);
+    }
+
+    const char **shapes = graded;
+    int nshapes = sizeof(graded) / sizeof(graded[0]);
+    if(optind < argc) {
+        shapes = (const char **)argv + optind;
+        nshapes = argc - optind;
+    }
+
+    variant_t best[nshapes];
+    int dims[nshapes][2];
+    for(int i = 0; i < nshapes; i++) {
+        int M, N, len;
+        unsigned long long naive;
+        char buf[128];
+
+        if(sscanf(shapes[i], "%dx%d%n", &M, &N, &len) != 2 || shapes[i][len] != '\0' ||
+           M < 1 || N < 1 || M > MAXN || N > MAXN) {
+            fprintf(stderr, "Bad shape %s, expected MxN with both at most %d\n", shapes[i], MAXN);
+            exit(1);
+        }
+        dims[i][0] = M;
+        dims[i][1] = N;
+        best[i] = Tune(&cfg, M, N, verbose, &naive);
+        fprintf(stderr, "%dx%d: %s, %llu misses (row-wise scan %llu)\n", M, N,
+                describe(&best[i], buf, sizeof(buf)), best[i].misses, naive);
+    }
+
+    FILE *fp = out != NULL ? fopen(out, "w") : stdout;
+    if(fp == NULL) {
+        fprintf(stderr, "%s: %s\n", out, strerror(errno));
+        exit(1);
+    }
+    fprintf(fp, "/*\n");
+    fprintf(fp, " * trans-tuned.h - Transpose variant per shape, picked by transtune for\n");
+    fprintf(fp, " *     s=%d E=%d b=%d. Regenerate with \"make tune\" rather than editing.\n", cfg.s, cfg.E, cfg.b);
+    fprintf(fp, " */\n");
+    fputs(trans_decls, fp);
+    fprintf(fp, "#define TRANS_TUNED_TABLE \\\n");
+    for(int i = 0; i < nshapes; i++) {
+        char buf[128];
+        fprintf(fp, "    /* %s, %llu misses */ \\\n", describe(&best[i], buf, sizeof(buf)), best[i].misses);
+        fprintf(fp, "    TRANS_TUNED(%d, %d, %s, %d, %d, %s) \\\n", dims[i][0], dims[i][1],
+                kernel_names[best[i].kernel], best[i].tile_w, best[i].tile_h,
+                flag_names(best[i].flags, buf, sizeof(buf)));
+    }
+    fprintf(fp, "\n");
+    if(fp != stdout && fclose(fp) != 0) {
+        fprintf(stderr, "%s: %s\n", out, strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,451 @@
+/*
+ * loadgen.c - HTTP load generator for benchmarking the proxy and tiny.
+ *
+ * Drives a fixed number of concurrent connections, either directly to
+ * the origin server or through the proxy, and reports throughput and
+ * latency percentiles.
+ *
+ * Closed loop (default): every connection issues its next request as
+ *     soon as the previous response has been read.
+ * Open loop (-r rate): requests are issued on a fixed schedule of
+ *     <rate> requests/sec. Latency is measured from the *intended*
+ *     send time, so a stalled server is charged for the requests that
+ *     queue up behind it (no coordinated omission).
+ *
+ * URL popularity follows a Zipf distribution over the path list
+ * (-z 0 gives a uniform mix).
+ *
+ * usage: see usage() below, e.g.
+ *     ./loadgen -o localhost:15213 -x localhost:15214 -c 8 -n 5000 \
+ *               -z 0.9 /home.html /godzilla.gif /tiny.c
+ */
+#include "csapp.h"
+#include <time.h>
+
+#define MAX_PATHS 256
+#define DEFAULT_REQUESTS 1000
+
+typedef struct {
+    int id;
+    unsigned long long rng;    /* xorshift64* state */
+
+    int fd;                    /* -1 when not connected */
+    rio_t rio;
+
+    unsigned long long *lat;   /* per-request latency in ns */
+    size_t nlat;
+    size_t cap;
+
+    long errors;
+    long reconnects;
+    unsigned long long bytes;
+} worker_t;
+
+/* Globals set on the command line */
+static char origin_host[MAXLINE], origin_port[MAXLINE];
+static char proxy_host[MAXLINE], proxy_port[MAXLINE];
+static int use_proxy = 0;
+static int nconns = 4;
+static long nrequests = 0;
+static double duration = 0;
+static double rate = 0;
+static double zipf_alpha = 0;
+static int keep_alive = 0;
+static int timeout_secs = 5;
+
+static char *paths[MAX_PATHS];
+static int npaths = 0;
+static double zipf_cdf[MAX_PATHS];
+
+static long next_ticket = 0;
+static unsigned long long t_start, t_stop;
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long t) {
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ULL;
+    ts.tv_nsec = t % 1000000000ULL;
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+        ;
+}
+
+static double next_uniform(worker_t *w) {
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return ((w->rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* zipf_init - cdf[k] = sum_{i<=k} (i+1)^-alpha, normalized */
+static void zipf_init() {
+    double sum = 0;
+    for(int i = 0; i < npaths; i++) {
+        sum += 1.0 / pow(i + 1, zipf_alpha);
+        zipf_cdf[i] = sum;
+    }
+    for(int i = 0; i < npaths; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+static int zipf_pick(worker_t *w) {
+    double u = next_uniform(w);
+    int lo = 0, hi = npaths - 1;
+    while( lo < hi ) {
+        int mid = (lo + hi) / 2;
+        if( zipf_cdf[mid] < u ) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void split_hostport(char *arg, char *host, char *port) {
+    char *colon = strrchr(arg, ':');
+    if( colon == NULL ) {
+        strcpy(host, arg);
+        strcpy(port, "80");
+        return ;
+    }
+    *colon = '\0';
+    strcpy(host, arg);
+    strcpy(port, colon + 1);
+    *colon = ':';
+}
+
+static void worker_connect(worker_t *w) {
+    if( use_proxy ) {
+        w->fd = open_clientfd(proxy_host, proxy_port);
+    }
+    else {
+        w->fd = open_clientfd(origin_host, origin_port);
+    }
+    if( w->fd >= 0 ) {
+        /* A wedged server shows up as an error instead of a hang */
+        struct timeval tv = { timeout_secs, 0 };
+        setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(w->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        rio_readinitb(&w->rio, w->fd);
+    }
+}
+
+static void worker_disconnect(worker_t *w) {
+    if( w->fd >= 0 ) {
+        close(w->fd);
+        w->fd = -1;
+    }
+}
+
+/*
+ * read_response - Read one response off w->fd. Returns the number of
+ *     bytes read, 0 if the peer closed before sending anything, or -1
+ *     on a malformed or non-200 response. *reusable is cleared if the
+ *     connection cannot carry another request.
+ */
+static long read_response(worker_t *w, int *reusable) {
+    char line[MAXLINE], body[MAXBUF];
+    long total = 0, content_length = -1;
+    int status = 0;
+    ssize_t n;
+
+    if( (n = rio_readlineb(&w->rio, line, MAXLINE)) <= 0 ) {
+        *reusable = 0;
+        return n < 0 ? -1 : 0;
+    }
+    total += n;
+    sscanf(line, "%*s %d", &status);
+
+    while( (n = rio_readlineb(&w->rio, line, MAXLINE)) > 0 ) {
+        total += n;
+        if( !strcmp(line, "\r\n") ) {
+            break;
+        }
+        if( !strncasecmp(line, "Content-length:", 15) ) {
+            content_length = atol(line + 15);
+        }
+        else if( !strncasecmp(line, "Connection:", 11) ) {
+            char *val = line + 11;
+            while( *val == ' ' ) {
+                val++;
+            }
+            if( !strncasecmp(val, "close", 5) ) {
+                *reusable = 0;
+            }
+        }
+    }
+    if( n <= 0 ) {
+        *reusable = 0;
+        return -1;
+    }
+
+    if( content_length < 0 ) {
+        /* No length: the body runs until the peer closes */
+        *reusable = 0;
+        while( (n = rio_readnb(&w->rio, body, MAXBUF)) > 0 ) {
+            total += n;
+        }
+    }
+    else {
+        long left = content_length;
+        while( left > 0 ) {
+            n = rio_readnb(&w->rio, body, left < MAXBUF ? left : MAXBUF);
+            if( n <= 0 ) {
+                *reusable = 0;
+                return -1;
+            }
+            left -= n;
+            total += n;
+        }
+    }
+
+    return status == 200 ? total : -1;
+}
+
+/*
+ * do_one - Send one request for paths[idx] and read the response,
+ *     reconnecting once if a kept-alive connection turns out to have
+ *     been closed by the peer. Returns 0 on success.
+ */
+static int do_one(worker_t *w, int idx) {
+    char req[MAXLINE];
+    int len;
+
+    if( use_proxy ) {
+        len = snprintf(req, MAXLINE, "GET http://%s:%s%s HTTP/1.0\r\n", origin_host, origin_port, paths[idx]);
+    }
+    else {
+        len = snprintf(req, MAXLINE, "GET %s HTTP/1.0\r\n", paths[idx]);
+    }
+    len += snprintf(req + len, MAXLINE - len, "Host: %s:%s\r\n%s\r\n",
+                    origin_host, origin_port,
+                    keep_alive ? "Connection: keep-alive\r\nProxy-Connection: keep-alive\r\n"
+                               : "Connection: close\r\n");
+
+    for(int attempt = 0; attempt < 2; attempt++) {
+        int reused = w->fd >= 0;
+        if( !reused ) {
+            worker_connect(w);
+            if( w->fd < 0 ) {
+                return -1;
+            }
+        }
+
+        int reusable = keep_alive;
+        long n = -1;
+        if( rio_writen(w->fd, req, len) == len ) {
+            n = read_response(w, &reusable);
+        }
+        if( !reusable || n <= 0 ) {
+            worker_disconnect(w);
+        }
+        if( n > 0 ) {
+            w->bytes += n;
+            return 0;
+        }
+        if( !reused ) {
+            return -1;
+        }
+        /* A stale kept-alive connection, try again on a fresh one */
+        w->reconnects++;
+    }
+    return -1;
+}
+
+static void record_latency(worker_t *w, unsigned long long ns) {
+    if( w->nlat == w->cap ) {
+        w->cap = w->cap ? w->cap * 2 : 1024;
+        w->lat = Realloc(w->lat, w->cap * sizeof(*w->lat));
+    }
+    w->lat[w->nlat++] = ns;
+}
+
+static void *worker(void *vargp) {
+    worker_t *w = (worker_t *)vargp;
+    double interval = rate > 0 ? 1e9 / rate : 0;
+
+    while( 1 ) {
+        long ticket = __sync_fetch_and_add(&next_ticket, 1);
+        if( nrequests > 0 && ticket >= nrequests ) {
+            break;
+        }
+
+        unsigned long long start;
+        if( rate > 0 ) {
+            /* Open loop: the request is due at its slot in the schedule */
+            start = t_start + (unsigned long long)(ticket * interval);
+            if( t_stop && start >= t_stop ) {
+                break;
+            }
+            sleep_until(start);
+        }
+        else {
+            start = now_ns();
+            if( t_stop && start >= t_stop ) {
+                break;
+            }
+        }
+
+        if( do_one(w, zipf_pick(w)) < 0 ) {
+            w->errors++;
+            continue;
+        }
+        record_latency(w, now_ns() - start);
+    }
+
+    worker_disconnect(w);
+    return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(unsigned long long *lat, size_t n, double p) {
+    if( n == 0 ) {
+        return 0;
+    }
+    size_t i = (size_t)ceil(p * n);
+    i = i == 0 ? 0 : i - 1;
+    return lat[i] / 1000.0;
+}
+
+static void report(worker_t *ws, unsigned long long elapsed) {
+    size_t n = 0;
+    long errors = 0, reconnects = 0;
+    unsigned long long bytes = 0;
+
+    for(int i = 0; i < nconns; i++) {
+        n += ws[i].nlat;
+        errors += ws[i].errors;
+        reconnects += ws[i].reconnects;
+        bytes += ws[i].bytes;
+    }
+
+    unsigned long long *all = Malloc((n ? n : 1) * sizeof(*all));
+    size_t k = 0;
+    for(int i = 0; i < nconns; i++) {
+        memcpy(all + k, ws[i].lat, ws[i].nlat * sizeof(*all));
+        k += ws[i].nlat;
+    }
+    qsort(all, n, sizeof(*all), cmp_ull);
+
+    double secs = elapsed / 1e9;
+    printf("mode:%s conns:%d keep-alive:%s zipf:%.2f paths:%d\n",
+           rate > 0 ? "open" : "closed", nconns, keep_alive ? "yes" : "no", zipf_alpha, npaths);
+    printf("requests:%zu errors:%ld reconnects:%ld elapsed:%.3fs\n", n, errors, reconnects, secs);
+    printf("throughput: %.1f req/s  %.2f MB/s\n", n / secs, bytes / secs / (1 << 20));
+    printf("latency(us): p50:%.1f p90:%.1f p99:%.1f p999:%.1f max:%.1f\n",
+           percentile_us(all, n, 0.50), percentile_us(all, n, 0.90),
+           percentile_us(all, n, 0.99), percentile_us(all, n, 0.999),
+           n ? all[n - 1] / 1000.0 : 0);
+    Free(all);
+}
+
+static void usage(char *argv0) {
+    printf("Usage: %s [-hk] -o <host:port> [-x <host:port>] [-c <num>] [-T <secs>]\n", argv0);
+    printf("       [-n <num> | -d <secs>] [-r <rate>] [-z <alpha>] <path>...\n");
+    printf("Options:\n");
+    printf("  -h              Print this help message.\n");
+    printf("  -o <host:port>  Origin server (e.g. tiny).\n");
+    printf("  -x <host:port>  Send requests through this proxy.\n");
+    printf("  -c <num>        Number of concurrent connections (default 4).\n");
+    printf("  -n <num>        Total number of requests (default %d).\n", DEFAULT_REQUESTS);
+    printf("  -d <secs>       Run for a fixed duration instead of -n.\n");
+    printf("  -r <rate>       Open loop at <rate> requests/sec.\n");
+    printf("  -z <alpha>      Zipf exponent for path popularity (default 0).\n");
+    printf("  -k              Keep connections alive between requests.\n");
+    printf("  -T <secs>       Per-request socket timeout (default 5).\n");
+    printf("Example: %s -o localhost:15213 -x localhost:15214 -c 8 -r 2000 -d 10 /home.html /godzilla.gif\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while( (opt = getopt(argc, argv, "ho:x:c:n:d:r:z:kT:")) != -1 ) {
+        switch( opt ) {
+            case 'o':
+                split_hostport(optarg, origin_host, origin_port);
+                break;
+            case 'x':
+                split_hostport(optarg, proxy_host, proxy_port);
+                use_proxy = 1;
+                break;
+            case 'c':
+                nconns = atoi(optarg);
+                break;
+            case 'n':
+                nrequests = atol(optarg);
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'z':
+                zipf_alpha = atof(optarg);
+                break;
+            case 'k':
+                keep_alive = 1;
+                break;
+            case 'T':
+                timeout_secs = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    for(int i = optind; i < argc && npaths < MAX_PATHS; i++) {
+        paths[npaths++] = argv[i];
+    }
+    if( origin_host[0] == '\0' || npaths == 0 || nconns <= 0 ) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if( nrequests <= 0 && duration <= 0 ) {
+        nrequests = DEFAULT_REQUESTS;
+    }
+
+    /* A dead peer must show up as a write error, not kill us */
+    Signal(SIGPIPE, SIG_IGN);
+    zipf_init();
+
+    worker_t *ws = Calloc(nconns, sizeof(worker_t));
+    pthread_t *tids = Calloc(nconns, sizeof(pthread_t));
+
+    t_start = now_ns();
+    t_stop = duration > 0 ? t_start + (unsigned long long)(duration * 1e9) : 0;
+    for(int i = 0; i < nconns; i++) {
+        ws[i].id = i;
+        ws[i].fd = -1;
+        ws[i].rng = ((0x9E3779B97F4A7C15ULL * (i + 1)) ^ t_start) | 1;
+        Pthread_create(&tids[i], NULL, worker, &ws[i]);
+    }
+    for(int i = 0; i < nconns; i++) {
+        Pthread_join(tids[i], NULL);
+    }
+
+    report(ws, now_ns() - t_start);
+
+    for(int i = 0; i < nconns; i++) {
+        Free(ws[i].lat);
+    }
+    Free(ws);
+    Free(tids);
+    return 0;
+}
@@ -1,17 +1,27 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <zlib.h>
 #include "csapp.h"
 #include "limits.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
-#define MAX_CACHE 10
+#define MAX_CACHE 64
 #define NTHREADS 4
+#define MAX_NTHREADS 256
+#define MAX_CPUS 1024      /* glibc's CPU_SETSIZE, which needs _GNU_SOURCE */
 #define SBUFSIZE 16
 #define NUM_CACHE_BLK 10
 
+/* Relay buffering between origin and client */
+#define RELAY_CHUNK MAXBUF
+#define RELAY_WINDOW MAX_OBJECT_SIZE
+#define MAX_RELAY_BYTES 1048576
+
 typedef struct {
     int *buf;
     int n;
@@ -31,8 +41,29 @@ struct uri_content {
     char port[MAXLINE];
 };
 
+/* Content codings a client accepts */
+#define ENC_GZIP 1
+#define ENC_DEFLATE 2
+
+/*
+ * With -z, text/html and text/plain responses are deflated once when
+ * they enter the cache. The deflated body is kept as a raw stream so
+ * both the gzip and the deflate framing can be put around it when the
+ * object is served. With -Z only the deflated form is kept and identity
+ * clients get it inflated on the way out.
+ */
 typedef struct {
-    char obj[MAX_OBJECT_SIZE];
+    char *obj;         /* identity response, NULL if only zbody is kept */
+    int size;
+    char *hdr;         /* response headers less Content-length and the blank line */
+    int hdr_size;
+    char *zbody;       /* raw deflate stream of the body, NULL if not compressed */
+    int zsize;
+    int body_size;     /* identity body length */
+    unsigned long crc;
+    unsigned long adler;
+    int prefetched;    /* filled by the prefetcher and not requested yet */
+
     char uri[MAXLINE];
     int stamp;
     int vaild;
@@ -47,23 +78,132 @@ typedef struct {
 } Cache;
 
 Cache cache;
+sem_t cache_lock;      /* serializes writers, guards cache_bytes and prefetch_bytes */
+int cache_bytes = 0;
+int compress_mode = 0; /* 0: off, 1: -z both variants, 2: -Z deflated only */
+
+/*
+ * With -p, links found in cached HTML pages are queued for a single
+ * low-priority prefetcher thread. It issues at most PREFETCH_RATE
+ * fetches a second, takes at most PREFETCH_PER_PAGE links from a page,
+ * and pauses while prefetched-but-unrequested objects hold more than
+ * PREFETCH_BUDGET bytes of the cache; the links it holds wait for the
+ * budget rather than being dropped. A full queue drops new links.
+ */
+#define PREFETCH_QUEUE 32
+#define PREFETCH_PER_PAGE 8
+#define PREFETCH_RATE 20
+#define PREFETCH_BUDGET (MAX_CACHE_SIZE / 4)
+
+typedef struct {
+    char uri[PREFETCH_QUEUE][MAXLINE];
+    int front;
+    int rear;
+
+    sem_t mutex;
+    sem_t slots;
+    sem_t items;
+} pqueue_t;
+
+pqueue_t prefetch_q;
+int prefetch_on = 0;
+int prefetch_bytes = 0;    /* guarded by cache_lock */
+
+/*
+ * A response is drained from the origin into a per-connection window so
+ * the origin socket can be closed before a slow client has read it.
+ * Each chunk is passed on to the client as soon as its socket takes it;
+ * only what the client has not accepted yet stays pending. Every
+ * RELAY_CHUNK pending in a window takes one unit of relay_budget, which
+ * caps the bytes held back across all connections. When the window or
+ * the budget runs out the relay falls back to lockstep streaming.
+ */
+typedef struct {
+    char buf[RELAY_WINDOW];
+    size_t len;        /* bytes of the response kept in buf */
+    size_t flushed;    /* bytes of buf already written to the client */
+    size_t total;      /* bytes of the response read from the origin */
+    int units;         /* relay_budget units held for unflushed bytes */
+    int streaming;
+} relay_t;
+
+sem_t relay_budget;
+
+/*
+ * The worker pool is resized by pool_manager() every POOL_TICK_MS. It
+ * grows while connections wait in sbuf and the workers are mostly busy
+ * (blocked on origin or client I/O), and retires one worker at a time
+ * after POOL_IDLE_TICKS quiet ticks. A worker is retired by queueing a
+ * POOL_RETIRE descriptor that it takes from sbuf like any connection.
+ */
+#define POOL_TICK_MS 100
+#define POOL_IDLE_TICKS 20
+#define POOL_GROW_UTIL 0.75
+#define POOL_SHRINK_UTIL 0.25
+#define POOL_RETIRE -1
+
+typedef struct {
+    int min;
+    int max;
+    int nthreads;      /* live workers, less those told to retire */
+    int nidle;         /* workers waiting in sbuf_remove() */
+    int next_id;
+    int peak_depth;    /* deepest sbuf backlog seen since the last tick */
+    unsigned long long busy_ns;    /* total time spent in do_request() */
+
+    int cpus[MAX_CPUS];            /* -a: cores to pin workers to */
+    int ncpus;
+
+    sem_t mutex;
+} pool_t;
+
+pool_t pool;
 
 void do_request(int fd);
 int parse_uri(char *uri, struct uri_content *uri_data);
-void build_header(char *header, struct uri_content *uri_data, rio_t *myio);
+void build_header(char *header, struct uri_content *uri_data, rio_t *myio, int *encodings);
+int parse_encodings(char *value);
 int connect_server(char *hostname, int port);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 
+void relay_init(relay_t *r);
+void relay_fill(int clientfd, rio_t *server_rio, relay_t *r);
+void relay_push(int clientfd, relay_t *r);
+void relay_flush(int clientfd, relay_t *r);
+
 void sbuf_init(sbuf_t *sbuf, int n);
 void sbuf_insert(sbuf_t *sbuf, int item);
 int sbuf_remove(sbuf_t *sbuf);
 void *thread(void *vargp);
 
+void pool_init(int min, int max);
+void pool_spawn(int n);
+void pool_note_depth();
+void pool_pin(int id);
+int pool_parse_cpus(char *list);
+void *pool_manager(void *vargp);
+
+void pqueue_init(pqueue_t *q);
+int pqueue_try_insert(pqueue_t *q, char *uri);
+void pqueue_remove(pqueue_t *q, char *uri);
+void prefetch_links(char *page_uri, char *buf, int size);
+void prefetch_fetch(char *uri);
+int prefetch_over_budget(void);
+void *prefetcher(void *vargp);
+
 void cache_init();
 int cache_srch(char *uri);
+void cache_release(int index);
+int cache_contains(char *uri);
+void cache_claim(int index, char *uri);
+char *response_body(char *buf, int size);
 int cache_index();
 void cache_update(int index);
-void cache_write(char *uri, char *buf);
+void cache_write(char *uri, char *buf, int size, int prefetched);
+void cache_serve(int fd, block *blk, int encodings);
+void cache_evict(int index);
+int cache_lru();
+int cache_compress(block *blk, char *buf, int size);
 
 /* You won't lose style points for including this long line in your code */
 static const char *connection_header = "Connection: close\r\n";
@@ -77,26 +217,64 @@ int main(int argc, char *argv[])
     socklen_t clientlen;
     char hostname[MAXLINE], port[MAXLINE];
     pthread_t tid;
+    int opt, min = NTHREADS, max = MAX_NTHREADS / 4;
+    char *cpus = NULL;
 
     struct sockaddr_storage clientaddr;
 
-    if( argc != 2 ) {
-        fprintf(stderr, "usage :%s <port> \n", argv[0]);
+    while( (opt = getopt(argc, argv, "m:M:a:zZp")) != -1 ) {
+        switch( opt ) {
+            case 'm':
+                min = atoi(optarg);
+                break;
+            case 'M':
+                max = atoi(optarg);
+                break;
+            case 'a':
+                cpus = optarg;
+                break;
+            case 'z':
+                compress_mode = 1;
+                break;
+            case 'Z':
+                compress_mode = 2;
+                break;
+            case 'p':
+                prefetch_on = 1;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if( optind != argc - 1 ) {
+        fprintf(stderr, "usage :%s [-m <min threads>] [-M <max threads>] [-a <cpu list>] [-z|-Z] [-p] <port> \n", argv[0]);
         exit(1);
     }
 
-    listenfd = Open_listenfd(argv[1]);
+    listenfd = Open_listenfd(argv[optind]);
 
     cache_init();
+    Sem_init(&relay_budget, 0, MAX_RELAY_BYTES / RELAY_CHUNK);
     sbuf_init(&sbuf, SBUFSIZE);
-    for(int i = 0; i < NTHREADS; i++) {
-        Pthread_create(&tid, NULL, thread, NULL);
+    pool_init(min, max);
+    if( cpus != NULL && !pool_parse_cpus(cpus) ) {
+        fprintf(stderr, "bad cpu list: %s\n", cpus);
+        exit(1);
+    }
+    pool_spawn(pool.min);
+    Pthread_create(&tid, NULL, pool_manager, NULL);
+    if( prefetch_on ) {
+        pqueue_init(&prefetch_q);
+        Pthread_create(&tid, NULL, prefetcher, NULL);
     }
 
     while( 1 ) {
         clientlen = sizeof(clientaddr);
         connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
         sbuf_insert(&sbuf, connfd);
+        pool_note_depth();
         Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
         printf("Accepted connection from (%s %s)\n", hostname, port);
     }
@@ -124,61 +302,140 @@ void do_request(int fd) {
     }
 
     struct uri_content *uri_data = (struct uri_content *)malloc(sizeof(struct uri_content));
+    int encodings;
+
+    parse_uri(uri, uri_data);
+    build_header(server, uri_data, &client_rio, &encodings);
 
     int idx;
     idx = cache_srch(cache_tag);
 
     if( idx != -1) {
-         P(&cache.data[idx].mutex);
-         cache.data[idx].readcnt++;
-         if( cache.data[idx].readcnt == 1 ) {
-             P(&cache.data[idx].w);
-         }
-         V(&cache.data[idx].mutex);
-         
-         Rio_writen(fd, cache.data[idx].obj, strlen(cache.data[idx].obj));
-
-        P(&cache.data[idx].mutex);
-        cache.data[idx].readcnt--;
-        if( cache.data[idx].readcnt == 0 ) {
-            V(&cache.data[idx].w);
-        }
-        V(&cache.data[idx].mutex);
+        /* cache_srch() returns with the block's read lock held */
+        cache_serve(fd, &cache.data[idx], encodings);
+        cache_release(idx);
+        if( cache.data[idx].prefetched ) {
+            cache_claim(idx, cache_tag);
+        }
         return ;
     }
 
-    parse_uri(uri, uri_data);
-    build_header(server, uri_data, &client_rio);
     serverfd = Open_clientfd(uri_data->hostname, uri_data->port);
     if(serverfd < 0) {
         fprintf(stderr, "connect server failed\n");
         return ;
     }
-    size_t read_bytes = 0;
-    char cache_buf[MAX_OBJECT_SIZE];
+
+    relay_t relay;
+    relay_init(&relay);
     Rio_readinitb(&server_rio, serverfd);
     Rio_writen(serverfd, server, strlen(server));
-    int n_read;
-    while( (n_read = Rio_readlineb(&server_rio, buf, MAXLINE)) != 0 ){
-        printf("Proxy receives %d bytes from server\n", n_read);
-        Rio_writen(fd, buf, n_read);
-        read_bytes += n_read;
-        if(read_bytes < MAX_OBJECT_SIZE) {
-            strcat(cache_buf, buf);
+    relay_fill(fd, &server_rio, &relay);
+    /* The whole response has been read, let the origin go */
+    Close(serverfd);
+    relay_flush(fd, &relay);
+    printf("Proxy receives %zu bytes from server\n", relay.total);
+
+    if(relay.total == relay.len && relay.total < MAX_OBJECT_SIZE) {
+        cache_write(cache_tag, relay.buf, relay.len, 0);
+        if( prefetch_on ) {
+            prefetch_links(cache_tag, relay.buf, relay.len);
         }
     }
-    Close(serverfd);
+}
+
+void relay_init(relay_t *r) {
+    r->len = 0;
+    r->flushed = 0;
+    r->total = 0;
+    r->units = 0;
+    r->streaming = 0;
+}
+
+/*
+ * relay_fill - Read the response from the origin until EOF. Chunks are
+ *     kept in r->buf and pushed to the client as they arrive while both
+ *     the window and the global relay budget allow it; after that
+ *     everything is written through to the client.
+ */
+void relay_fill(int clientfd, rio_t *server_rio, relay_t *r) {
+    char chunk[RELAY_CHUNK];
+    ssize_t n;
+
+    while( (n = Rio_readnb(server_rio, chunk, RELAY_CHUNK)) > 0 ) {
+        int fits = r->len + n <= RELAY_WINDOW;
+        r->total += n;
+
+        if( !r->streaming ) {
+            if( fits && sem_trywait(&relay_budget) == 0 ) {
+                r->units++;
+                memcpy(r->buf + r->len, chunk, n);
+                r->len += n;
+                relay_push(clientfd, r);
+                continue;
+            }
+            /* Out of window or budget: push back on the origin */
+            relay_flush(clientfd, r);
+            r->streaming = 1;
+        }
+
+        Rio_writen(clientfd, chunk, n);
+        /* Keep a copy while the response may still be cacheable */
+        if( fits && r->len == r->total - n ) {
+            memcpy(r->buf + r->len, chunk, n);
+            r->len += n;
+            r->flushed = r->len;
+        }
+    }
+}
+
+/*
+ * relay_push - Write as much of the buffered part of the response as the
+ *     client socket takes without blocking. Once the client has caught
+ *     up the budget held for the window is handed back.
+ */
+void relay_push(int clientfd, relay_t *r) {
+    while( r->len > r->flushed ) {
+        ssize_t n = send(clientfd, r->buf + r->flushed, r->len - r->flushed,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( n <= 0 ) {
+            /* Client is behind (or gone); relay_flush() deals with it */
+            return ;
+        }
+        r->flushed += n;
+    }
+    while( r->units > 0 ) {
+        V(&relay_budget);
+        r->units--;
+    }
+}
 
-    if(read_bytes < MAX_OBJECT_SIZE) {
-        cache_write(cache_tag, cache_buf);
+/*
+ * relay_flush - Write the buffered part of the response to the client
+ *     and hand its relay budget back.
+ */
+void relay_flush(int clientfd, relay_t *r) {
+    if( r->len > r->flushed ) {
+        Rio_writen(clientfd, r->buf + r->flushed, r->len - r->flushed);
+        r->flushed = r->len;
+    }
+    while( r->units > 0 ) {
+        V(&relay_budget);
+        r->units--;
     }
 }
 
 int parse_uri(char *uri, struct uri_content *uri_data) {
     char *ptr, *hostname_ptr, *port_ptr, *path_ptr;
 
+    strcpy(uri_data->port, "80");
+    strcpy(uri_data->path, "/");
+
     ptr = strstr(uri, "//");
-    ptr = ptr == NULL ? ptr : ptr + 2;
+    ptr = ptr == NULL ? uri : ptr + 2;
     port_ptr = strstr(ptr, ":");
 
     /* 如果没有显式端口 */
@@ -211,18 +468,70 @@ int parse_uri(char *uri, struct uri_content *uri_data) {
     }
 }
 
-void build_header(char *header, struct uri_content *uri_data, rio_t *myio) {
+/*
+ * parse_encodings - ENC_ mask of the codings an Accept-Encoding value
+ *     allows. A coding with q=0 is refused, and "*" stands for every
+ *     coding the value does not name.
+ */
+int parse_encodings(char *value) {
+    int accepted = 0, named = 0, wildcard = 0;
+    char *save, *token;
+
+    for(token = strtok_r(value, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        char *params = strchr(token, ';'), *q;
+        int refused = 0, enc = 0;
+
+        while( isspace((unsigned char)*token) ) {
+            token++;
+        }
+        int len = strcspn(token, "; \t\r\n");
+        for(q = params; q != NULL; q = strchr(q + 1, ';')) {
+            char *v = q + 1;
+            while( isspace((unsigned char)*v) ) {
+                v++;
+            }
+            if( (v[0] == 'q' || v[0] == 'Q') && v[1] == '=' ) {
+                refused = strtod(v + 2, NULL) <= 0;
+            }
+        }
+
+        if( (len == 4 && !strncasecmp(token, "gzip", 4)) || (len == 6 && !strncasecmp(token, "x-gzip", 6)) ) {
+            enc = ENC_GZIP;
+        }
+        else if( len == 7 && !strncasecmp(token, "deflate", 7) ) {
+            enc = ENC_DEFLATE;
+        }
+        else if( len == 1 && token[0] == '*' ) {
+            wildcard = !refused;
+            continue;
+        }
+        named |= enc;
+        accepted |= refused ? 0 : enc;
+    }
+    return accepted | (wildcard ? (ENC_GZIP | ENC_DEFLATE) & ~named : 0);
+}
+
+void build_header(char *header, struct uri_content *uri_data, rio_t *myio, int *encodings) {
     char buf[MAXLINE], request_header[MAXLINE], host_header[MAXLINE], other_header[MAXLINE];
 
+    other_header[0] = '\0';
+    *encodings = 0;
+
     sprintf(request_header, "GET %s HTTP/1.0\r\n", uri_data->path);
     sprintf(host_header, "HOST: %s\r\n", uri_data->hostname);
-    while( Rio_readlineb(myio, buf, MAXLINE) > 0 ) {
+    /* The prefetcher has no client headers to pass on */
+    while( myio != NULL && Rio_readlineb(myio, buf, MAXLINE) > 0 ) {
         if( !strcmp(buf, end_header) ) {
             break;
         }
         else if( !strncasecmp(buf, "HOST", 4) ) {
             strcpy(host_header, buf);
         }
+        else if( !strncasecmp(buf, "Accept-Encoding:", 16) ) {
+            *encodings |= parse_encodings(buf + 16);
+            /* The origin only ever sends identity, cache variants are ours */
+            continue;
+        }
         else if( !strncasecmp(buf, "User-Agent", 10)
                 || !strncasecmp(buf, "Proxy-Connection", 16)
                 || !strncasecmp(buf, "Connection", 10) ) {
@@ -292,15 +601,175 @@ int sbuf_remove(sbuf_t *sbuf) {
 
 void *thread(void *vargp) {
     Pthread_detach(pthread_self());
+    pool_pin((int)(long)vargp);
     while( 1 ) {
+        P(&pool.mutex);
+        pool.nidle++;
+        V(&pool.mutex);
+
         int connfd = sbuf_remove(&sbuf);
+
+        P(&pool.mutex);
+        pool.nidle--;
+        V(&pool.mutex);
+
+        if( connfd == POOL_RETIRE ) {
+            break;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         do_request(connfd);
         Close(connfd);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        P(&pool.mutex);
+        pool.busy_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+        V(&pool.mutex);
+    }
+    return NULL;
+}
+
+void pool_init(int min, int max) {
+    pool.min = min < 1 ? 1 : min;
+    pool.max = max > MAX_NTHREADS ? MAX_NTHREADS : max;
+    pool.max = pool.max < pool.min ? pool.min : pool.max;
+    pool.nthreads = 0;
+    pool.nidle = 0;
+    pool.next_id = 0;
+    pool.peak_depth = 0;
+    pool.busy_ns = 0;
+    pool.ncpus = 0;
+    Sem_init(&pool.mutex, 0, 1);
+}
+
+/* pool_spawn - Start n more workers, the caller accounts for them */
+void pool_spawn(int n) {
+    pthread_t tid;
+    for(int i = 0; i < n; i++) {
+        P(&pool.mutex);
+        pool.nthreads++;
+        int id = pool.next_id++;
+        V(&pool.mutex);
+        Pthread_create(&tid, NULL, thread, (void *)(long)id);
+    }
+}
+
+void pool_note_depth() {
+    int depth;
+    sem_getvalue(&sbuf.items, &depth);
+    P(&pool.mutex);
+    if( depth > pool.peak_depth ) {
+        pool.peak_depth = depth;
+    }
+    V(&pool.mutex);
+}
+
+/*
+ * pool_pin - Pin the calling worker to one of the -a cores, round
+ *     robin by worker id. The raw syscall keeps us clear of
+ *     _GNU_SOURCE, whose gai_error() clashes with csapp.h.
+ */
+void pool_pin(int id) {
+    unsigned long mask[MAX_CPUS / (8 * sizeof(unsigned long))] = {0};
+    int cpu;
+
+    if( pool.ncpus == 0 ) {
+        return ;
+    }
+    cpu = pool.cpus[id % pool.ncpus];
+    mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+    if( syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0 ) {
+        fprintf(stderr, "worker %d: cannot pin to cpu %d\n", id, cpu);
+    }
+}
+
+/* pool_parse_cpus - Parse a cpu list such as "0-3,8,10-11" into pool.cpus */
+int pool_parse_cpus(char *list) {
+    char *p = list;
+    while( *p ) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if( end == p ) {
+            return 0;
+        }
+        if( *end == '-' ) {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if( end == p ) {
+                return 0;
+            }
+        }
+        for(long c = lo; c <= hi; c++) {
+            if( c < 0 || c >= MAX_CPUS || pool.ncpus == MAX_CPUS ) {
+                return 0;
+            }
+            pool.cpus[pool.ncpus++] = c;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if( *end != ',' && *end != '\0' ) {
+            return 0;
+        }
+    }
+    return pool.ncpus > 0;
+}
+
+/*
+ * pool_manager - Periodically compare the sbuf backlog and worker
+ *     utilization against the grow/shrink thresholds.
+ */
+void *pool_manager(void *vargp) {
+    unsigned long long last_busy = 0;
+    int quiet_ticks = 0;
+
+    Pthread_detach(pthread_self());
+    while( 1 ) {
+        usleep(POOL_TICK_MS * 1000);
+
+        P(&pool.mutex);
+        int depth = pool.peak_depth;
+        pool.peak_depth = 0;
+        int n = pool.nthreads;
+        int nidle = pool.nidle;
+        unsigned long long busy = pool.busy_ns - last_busy;
+        last_busy = pool.busy_ns;
+        V(&pool.mutex);
+
+        /* Long requests only report busy time when they finish, so
+           also count the workers that are out of sbuf right now */
+        double util = (double)busy / ((double)n * POOL_TICK_MS * 1000000);
+        double active = (double)(n - nidle) / n;
+        util = util > active ? util : active;
+
+        /* Grow on a busy pool with a backlog, or on a backlog that
+           is deeper than the pool itself */
+        if( depth > 0 && (util > POOL_GROW_UTIL || depth >= n) && n < pool.max ) {
+            int grow = depth < pool.max - n ? depth : pool.max - n;
+            pool_spawn(grow);
+            quiet_ticks = 0;
+        }
+        else if( depth == 0 && util < POOL_SHRINK_UTIL ) {
+            if( ++quiet_ticks >= POOL_IDLE_TICKS && n > pool.min ) {
+                P(&pool.mutex);
+                pool.nthreads--;
+                V(&pool.mutex);
+                sbuf_insert(&sbuf, POOL_RETIRE);
+                quiet_ticks = 0;
+            }
+        }
+        else {
+            quiet_ticks = 0;
+        }
     }
+    return NULL;
 }
 
 void cache_init() {
+    Sem_init(&cache_lock, 0, 1);
     for(int i = 0; i < MAX_CACHE; i++) {
+        cache.data[i].obj = NULL;
+        cache.data[i].hdr = NULL;
+        cache.data[i].zbody = NULL;
         cache.data[i].stamp = 0;
         cache.data[i].vaild = 0;
         cache.data[i].readcnt = 0;
@@ -336,6 +805,36 @@ int cache_srch(char *uri) {
     return i;
 }
 
+/* cache_release - Drop the read lock cache_srch() returned with */
+void cache_release(int index) {
+    P(&cache.data[index].mutex);
+    cache.data[index].readcnt--;
+    if( cache.data[index].readcnt == 0 ) {
+        V(&cache.data[index].w);
+    }
+    V(&cache.data[index].mutex);
+}
+
+int cache_contains(char *uri) {
+    int idx = cache_srch(uri);
+    if( idx == -1 ) {
+        return 0;
+    }
+    cache_release(idx);
+    return 1;
+}
+
+/* cache_claim - A client asked for a prefetched object, stop charging it to the prefetch budget */
+void cache_claim(int index, char *uri) {
+    P(&cache_lock);
+    block *blk = &cache.data[index];
+    if( blk->vaild && blk->prefetched && !strcmp(blk->uri, uri) ) {
+        blk->prefetched = 0;
+        prefetch_bytes -= (blk->obj ? blk->size : 0) + (blk->zbody ? blk->hdr_size + blk->zsize : 0);
+    }
+    V(&cache_lock);
+}
+
 int cache_index() {
     int min = INT_MAX;
     int idx = 0;
@@ -390,16 +889,415 @@ void cache_update(int index) {
     }
 }
 
-void cache_write(char *uri, char *buf) {
+/* cache_lru - Least recently written valid block, or -1 if empty */
+int cache_lru() {
+    int min = INT_MAX;
+    int idx = -1;
+    for(int i = 0; i < MAX_CACHE; i++) {
+        if( cache.data[i].vaild && cache.data[i].stamp < min ) {
+            min = cache.data[i].stamp;
+            idx = i;
+        }
+    }
+    return idx;
+}
+
+/* cache_evict - Drop block index, the caller holds cache_lock */
+void cache_evict(int index) {
+    block *blk = &cache.data[index];
+
+    P(&blk->w);
+    if( blk->vaild ) {
+        int cost = (blk->obj ? blk->size : 0) + (blk->zbody ? blk->hdr_size + blk->zsize : 0);
+        cache_bytes -= cost;
+        prefetch_bytes -= blk->prefetched ? cost : 0;
+        Free(blk->obj);
+        Free(blk->hdr);
+        Free(blk->zbody);
+        blk->obj = blk->hdr = blk->zbody = NULL;
+        blk->vaild = 0;
+    }
+    V(&blk->w);
+}
+
+void cache_write(char *uri, char *buf, int size, int prefetched) {
+    block staged;
+
+    /* Compress outside the lock, it is the slow part */
+    staged.obj = NULL;
+    staged.hdr = NULL;
+    staged.zbody = NULL;
+    if( compress_mode ) {
+        cache_compress(&staged, buf, size);
+    }
+    if( staged.zbody == NULL || compress_mode == 1 ) {
+        staged.obj = Malloc(size);
+        memcpy(staged.obj, buf, size);
+        staged.size = size;
+    }
+    int cost = (staged.obj ? staged.size : 0) + (staged.zbody ? staged.hdr_size + staged.zsize : 0);
+
+    P(&cache_lock);
+
+    int victim;
+    while( cache_bytes + cost > MAX_CACHE_SIZE && (victim = cache_lru()) != -1 ) {
+        cache_evict(victim);
+    }
+
     int i = cache_index();
+    cache_evict(i);
 
     P(&cache.data[i].w);
 
-    strcpy(cache.data[i].obj, buf);
+    cache.data[i].obj = staged.obj;
+    cache.data[i].size = staged.size;
+    cache.data[i].hdr = staged.hdr;
+    cache.data[i].hdr_size = staged.hdr_size;
+    cache.data[i].zbody = staged.zbody;
+    cache.data[i].zsize = staged.zsize;
+    cache.data[i].body_size = staged.body_size;
+    cache.data[i].crc = staged.crc;
+    cache.data[i].adler = staged.adler;
+    cache.data[i].prefetched = prefetched;
     strcpy(cache.data[i].uri, uri);
     cache.data[i].vaild = 1;
     cache.data[i].stamp = INT_MAX;
     cache_update(i);
+    cache_bytes += cost;
+    prefetch_bytes += prefetched ? cost : 0;
 
     V(&cache.data[i].w);
-}
\ No newline at end of file
+
+    V(&cache_lock);
+}
+
+/*
+ * cache_compress - If buf is a 200 text/html or text/plain response,
+ *     fill in blk->hdr and the deflated body. Returns 1 if it did.
+ */
+int cache_compress(block *blk, char *buf, int size) {
+    char *body = response_body(buf, size), *line, *eol;
+    int compressible = 0;
+
+    if( body == NULL ) {
+        return 0;
+    }
+
+    blk->hdr = Malloc(body - buf);
+    blk->hdr_size = 0;
+    for(line = buf; line < body - 2; line = eol + 2) {
+        eol = line;
+        while( memcmp(eol, "\r\n", 2) ) {
+            eol++;
+        }
+        if( !strncasecmp(line, "Content-Encoding:", 17) ) {
+            compressible = 0;
+            break;
+        }
+        if( !strncasecmp(line, "Content-type:", 13) ) {
+            char *val = line + 13;
+            while( *val == ' ' ) {
+                val++;
+            }
+            compressible = !strncasecmp(val, "text/html", 9) || !strncasecmp(val, "text/plain", 10);
+        }
+        if( strncasecmp(line, "Content-length:", 15) ) {
+            memcpy(blk->hdr + blk->hdr_size, line, eol + 2 - line);
+            blk->hdr_size += eol + 2 - line;
+        }
+    }
+
+    blk->body_size = size - (body - buf);
+    if( compressible && blk->body_size > 0 ) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        blk->zbody = Malloc(deflateBound(&zs, blk->body_size));
+        zs.next_in = (Bytef *)body;
+        zs.avail_in = blk->body_size;
+        zs.next_out = (Bytef *)blk->zbody;
+        zs.avail_out = deflateBound(&zs, blk->body_size);
+        deflate(&zs, Z_FINISH);
+        blk->zsize = zs.total_out;
+        deflateEnd(&zs);
+
+        blk->crc = crc32(crc32(0, Z_NULL, 0), (Bytef *)body, blk->body_size);
+        blk->adler = adler32(adler32(0, Z_NULL, 0), (Bytef *)body, blk->body_size);
+        /* Keep it only if it pays for the extra header copy */
+        if( blk->zsize + blk->hdr_size < blk->body_size ) {
+            return 1;
+        }
+    }
+
+    Free(blk->hdr);
+    Free(blk->zbody);
+    blk->hdr = blk->zbody = NULL;
+    return 0;
+}
+
+/*
+ * cache_serve - Write a cached object to fd in the best coding the
+ *     client accepts. The caller holds the block's read lock.
+ */
+void cache_serve(int fd, block *blk, int encodings) {
+    char buf[MAXLINE];
+    unsigned char frame[10];
+    int n;
+
+    if( blk->zbody == NULL ) {
+        Rio_writen(fd, blk->obj, blk->size);
+        return ;
+    }
+
+    Rio_writen(fd, blk->hdr, blk->hdr_size);
+    if( encodings & ENC_GZIP ) {
+        n = sprintf(buf, "Content-length: %d\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\n\r\n", blk->zsize + 18);
+        Rio_writen(fd, buf, n);
+        /* gzip member header: magic, deflate, no flags, no mtime, unix */
+        unsigned char head[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        Rio_writen(fd, head, 10);
+        Rio_writen(fd, blk->zbody, blk->zsize);
+        for(int i = 0; i < 4; i++) {
+            frame[i] = blk->crc >> (8 * i);
+            frame[i + 4] = (unsigned)blk->body_size >> (8 * i);
+        }
+        Rio_writen(fd, frame, 8);
+    }
+    else if( encodings & ENC_DEFLATE ) {
+        n = sprintf(buf, "Content-length: %d\r\nContent-Encoding: deflate\r\nVary: Accept-Encoding\r\n\r\n", blk->zsize + 6);
+        Rio_writen(fd, buf, n);
+        frame[0] = 0x78;
+        frame[1] = 0x9c;
+        Rio_writen(fd, frame, 2);
+        Rio_writen(fd, blk->zbody, blk->zsize);
+        for(int i = 0; i < 4; i++) {
+            frame[i] = blk->adler >> (8 * (3 - i));
+        }
+        Rio_writen(fd, frame, 4);
+    }
+    else if( blk->obj != NULL ) {
+        /* Every variant of a compressible object says it varies */
+        n = sprintf(buf, "Content-length: %d\r\nVary: Accept-Encoding\r\n\r\n", blk->body_size);
+        Rio_writen(fd, buf, n);
+        Rio_writen(fd, blk->obj + blk->size - blk->body_size, blk->body_size);
+    }
+    else {
+        /* Only the deflated form was kept, inflate it for this client */
+        char *body = Malloc(blk->body_size);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        inflateInit2(&zs, -MAX_WBITS);
+        zs.next_in = (Bytef *)blk->zbody;
+        zs.avail_in = blk->zsize;
+        zs.next_out = (Bytef *)body;
+        zs.avail_out = blk->body_size;
+        inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+
+        n = sprintf(buf, "Content-length: %d\r\nVary: Accept-Encoding\r\n\r\n", blk->body_size);
+        Rio_writen(fd, buf, n);
+        Rio_writen(fd, body, blk->body_size);
+        Free(body);
+    }
+}
+
+/*
+ * response_body - Start of the body of a cached 200 response, or NULL
+ *     if buf is anything else.
+ */
+char *response_body(char *buf, int size) {
+    int status = 0;
+
+    sscanf(buf, "%*s %d", &status);
+    if( status != 200 ) {
+        return NULL;
+    }
+    for(int i = 0; i + 4 <= size; i++) {
+        if( !memcmp(buf + i, "\r\n\r\n", 4) ) {
+            return buf + i + 4;
+        }
+    }
+    return NULL;
+}
+
+void pqueue_init(pqueue_t *q) {
+    q->front = q->rear = 0;
+    Sem_init(&q->mutex, 0, 1);
+    Sem_init(&q->slots, 0, PREFETCH_QUEUE);
+    Sem_init(&q->items, 0, 0);
+}
+
+/* pqueue_try_insert - Queue uri unless the queue is full, never blocks */
+int pqueue_try_insert(pqueue_t *q, char *uri) {
+    if( sem_trywait(&q->slots) < 0 ) {
+        return 0;
+    }
+    P(&q->mutex);
+    strcpy(q->uri[ (++q->rear)%PREFETCH_QUEUE ], uri);
+    V(&q->mutex);
+    V(&q->items);
+    return 1;
+}
+
+void pqueue_remove(pqueue_t *q, char *uri) {
+    P(&q->items);
+    P(&q->mutex);
+    strcpy(uri, q->uri[ (++q->front)%PREFETCH_QUEUE ]);
+    V(&q->mutex);
+    V(&q->slots);
+}
+
+/*
+ * prefetch_links - Queue the src= and href= targets of an HTML page,
+ *     resolved against page_uri. Only plain http links are followed.
+ */
+void prefetch_links(char *page_uri, char *buf, int size) {
+    char *body = response_body(buf, size), *end = buf + size;
+    char link[MAXLINE], uri[MAXLINE];
+    int queued = 0, html = 0;
+
+    if( body == NULL ) {
+        return ;
+    }
+    for(char *line = buf; line < body - 2; line = strstr(line, "\r\n") + 2) {
+        if( !strncasecmp(line, "Content-type:", 13) ) {
+            char *val = line + 13;
+            while( *val == ' ' ) {
+                val++;
+            }
+            html = !strncasecmp(val, "text/html", 9);
+            break;
+        }
+    }
+    /* Without an explicit text/html there is no telling what the body is */
+    if( !html ) {
+        return ;
+    }
+
+    /* Scheme and authority of the page, e.g. "http://localhost:8080" */
+    char *authority = strstr(page_uri, "//");
+    authority = authority == NULL ? page_uri : authority + 2;
+    char *root = strchr(authority, '/');
+    int root_len = root == NULL ? (int)strlen(page_uri) : root - page_uri;
+    char *dir = strrchr(page_uri, '/');
+    int dir_len = dir == NULL ? root_len : dir + 1 - page_uri;
+    dir_len = dir_len < root_len ? root_len : dir_len;
+
+    for(char *p = body; p < end && queued < PREFETCH_PER_PAGE; p++) {
+        int attr;
+        if( p > body && !isspace((unsigned char)p[-1]) ) {
+            continue;
+        }
+        if( end - p > 4 && !strncasecmp(p, "src=", 4) ) {
+            attr = 4;
+        }
+        else if( end - p > 5 && !strncasecmp(p, "href=", 5) ) {
+            attr = 5;
+        }
+        else {
+            continue;
+        }
+
+        char *q = p + attr, quote = 0;
+        if( *q == '"' || *q == '\'' ) {
+            quote = *q++;
+        }
+        int n = 0;
+        while( q < end && n < MAXLINE / 2 && *q != '#' && *q != '>'
+               && (quote ? *q != quote : !isspace((unsigned char)*q)) ) {
+            link[n++] = *q++;
+        }
+        link[n] = '\0';
+        p = q;
+
+        if( n == 0 || n == MAXLINE / 2 ) {
+            continue;
+        }
+        int len;
+        if( !strncasecmp(link, "http://", 7) ) {
+            len = snprintf(uri, sizeof(uri), "%s", link);
+        }
+        else if( !strncmp(link, "//", 2) ) {
+            len = snprintf(uri, sizeof(uri), "http:%s", link);
+        }
+        else if( strchr(link, ':') != NULL ) {
+            /* https:, mailto:, javascript: and friends */
+            continue;
+        }
+        else if( link[0] == '/' ) {
+            len = snprintf(uri, sizeof(uri), "%.*s%s", root_len, page_uri, link);
+        }
+        else {
+            len = snprintf(uri, sizeof(uri), "%.*s%s", dir_len, page_uri, link);
+        }
+        if( len >= (int)sizeof(uri) ) {
+            /* Too long to be a request line we would send */
+            continue;
+        }
+
+        if( !cache_contains(uri) && pqueue_try_insert(&prefetch_q, uri) ) {
+            queued++;
+        }
+    }
+}
+
+/* prefetch_fetch - Fetch uri from its origin straight into the cache */
+void prefetch_fetch(char *uri) {
+    char tag[MAXLINE], request[MAXLINE];
+    struct uri_content uri_data;
+    int encodings, fd;
+    ssize_t n;
+    size_t total = 0;
+    rio_t rio;
+
+    strcpy(tag, uri);
+    parse_uri(uri, &uri_data);
+    build_header(request, &uri_data, NULL, &encodings);
+
+    if( (fd = open_clientfd(uri_data.hostname, uri_data.port)) < 0 ) {
+        return ;
+    }
+    char *buf = Malloc(MAX_OBJECT_SIZE);
+    rio_readinitb(&rio, fd);
+    if( rio_writen(fd, request, strlen(request)) == strlen(request) ) {
+        while( total < MAX_OBJECT_SIZE
+               && (n = rio_readnb(&rio, buf + total, MAX_OBJECT_SIZE - total)) > 0 ) {
+            total += n;
+        }
+    }
+    Close(fd);
+
+    if( total > 0 && total < MAX_OBJECT_SIZE && response_body(buf, total) != NULL ) {
+        cache_write(tag, buf, total, 1);
+    }
+    Free(buf);
+}
+
+/* prefetch_over_budget - Do prefetched-but-unrequested objects fill their share of the cache? */
+int prefetch_over_budget(void) {
+    P(&cache_lock);
+    int over = prefetch_bytes >= PREFETCH_BUDGET;
+    V(&cache_lock);
+    return over;
+}
+
+void *prefetcher(void *vargp) {
+    char uri[MAXLINE];
+
+    Pthread_detach(pthread_self());
+    /* Demand traffic comes first */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    while( 1 ) {
+        pqueue_remove(&prefetch_q, uri);
+        /* Hold on to the link until demand traffic frees up the budget */
+        while( prefetch_over_budget() ) {
+            usleep(1000000 / PREFETCH_RATE);
+        }
+        if( cache_contains(uri) ) {
+            continue;
+        }
+        prefetch_fetch(uri);
+        usleep(1000000 / PREFETCH_RATE);
+    }
+    return NULL;
+}